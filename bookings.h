@@ -0,0 +1,80 @@
+#ifndef BOOKINGS_H
+#define BOOKINGS_H
+
+#include <ctime>
+#include <vector>
+
+// A period [startDate, endDate) during which a car is reserved. The bookings
+// of a car never overlap, so keeping them sorted by start date also keeps
+// them sorted by end date, and both can be binary searched.
+struct Booking
+{
+    time_t startDate;
+    time_t endDate;
+    int reservation; // reservation handle
+};
+
+// index of the first booking that ends after t
+inline int bookings_firstEndingAfter(const std::vector<Booking> &bookings, time_t t)
+{
+    int low = 0, high = (int)bookings.size();
+    while (low < high)
+    {
+        int mid = (low + high) / 2;
+        if (bookings[mid].endDate <= t)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    return low;
+}
+
+// true if [startDate, endDate) overlaps no booking other than `ignore`
+inline bool bookings_isFree(const std::vector<Booking> &bookings, time_t startDate,
+                            time_t endDate, int ignore = -1)
+{
+    for (int i = bookings_firstEndingAfter(bookings, startDate);
+         i < (int)bookings.size() && bookings[i].startDate < endDate; i++)
+        if (bookings[i].reservation != ignore)
+            return false;
+    return true;
+}
+
+// start of the first free window of the given length at or after `from`
+inline time_t bookings_nextFree(const std::vector<Booking> &bookings, time_t from,
+                                time_t length, int ignore = -1)
+{
+    time_t start = from;
+    for (int i = bookings_firstEndingAfter(bookings, from);
+         i < (int)bookings.size() && bookings[i].startDate < start + length; i++)
+        if (bookings[i].reservation != ignore && bookings[i].endDate > start)
+            start = bookings[i].endDate;
+    return start;
+}
+
+// the booking in progress at t, or else the next one; -1 if there is none
+inline int bookings_current(const std::vector<Booking> &bookings, time_t t)
+{
+    int i = bookings_firstEndingAfter(bookings, t);
+    return i < (int)bookings.size() ? i : -1;
+}
+
+// the caller checks with bookings_isFree first
+inline void bookings_insert(std::vector<Booking> &bookings, const Booking &booking)
+{
+    int i = bookings_firstEndingAfter(bookings, booking.startDate);
+    bookings.insert(bookings.begin() + i, booking);
+}
+
+inline void bookings_remove(std::vector<Booking> &bookings, time_t startDate, int reservation)
+{
+    for (int i = bookings_firstEndingAfter(bookings, startDate);
+         i < (int)bookings.size() && bookings[i].startDate <= startDate; i++)
+        if (bookings[i].reservation == reservation)
+        {
+            bookings.erase(bookings.begin() + i);
+            return;
+        }
+}
+
+#endif
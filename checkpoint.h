@@ -0,0 +1,129 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <atomic>
+#include <cstdio>
+#include <ctime>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// Runs at most one compaction at a time on a background thread. The caller
+// hands over a job that only touches its own copy of the data, so the main
+// thread can keep changing the live data meanwhile.
+struct Compactor
+{
+    std::thread worker;
+    std::atomic<bool> busy;
+    long long maxJournalSize; // compact once the journal grows past this...
+    double maxJournalAge;     // ...or once its oldest event is this old (seconds)
+
+    Compactor() : busy(false), maxJournalSize(0), maxJournalAge(0) {}
+};
+
+// true if a compaction is still running
+inline bool compactor_busy(Compactor &compactor)
+{
+    if (compactor.busy)
+        return true;
+    if (compactor.worker.joinable())
+        compactor.worker.join();
+    return false;
+}
+
+inline bool compactor_due(const Compactor &compactor, long long journalSize, time_t journalStart)
+{
+    if (journalSize == 0)
+        return false;
+    return journalSize >= compactor.maxJournalSize ||
+           std::difftime(std::time(NULL), journalStart) >= compactor.maxJournalAge;
+}
+
+// the caller checks compactor_busy first
+template <class Job>
+void compactor_start(Compactor &compactor, Job job)
+{
+    compactor.busy = true;
+    compactor.worker = std::thread([&compactor, job]() mutable
+                                   {
+                                       job();
+                                       compactor.busy = false;
+                                   });
+}
+
+inline void compactor_wait(Compactor &compactor)
+{
+    if (compactor.worker.joinable())
+        compactor.worker.join();
+}
+
+// Files are replaced in two steps: each new version is first written and
+// synced under a temporary name (stage_file), then all of them are renamed
+// over the old ones and the directory is synced once (commit_files). A crash
+// at any point leaves every file either old or new, never half written.
+
+inline std::string staged_name(const std::string &fileName)
+{
+    return fileName + ".tmp";
+}
+
+// forces a file or a directory to the disk
+inline bool sync_path(const std::string &path)
+{
+#ifndef _WIN32
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd == -1)
+        return false;
+    bool synced = fsync(fd) == 0;
+    close(fd);
+    return synced;
+#else
+    return true; // renames are not journaled by the directory there
+#endif
+}
+
+// returns false, and leaves no temporary file behind, if writing fails
+template <class Write>
+bool stage_file(const std::string &fileName, Write write)
+{
+    std::string tmpFileName = staged_name(fileName);
+    std::ofstream os(tmpFileName.c_str(), std::ios::binary);
+    write(os);
+    os.close();
+    if (!os || !sync_path(tmpFileName))
+    {
+        std::remove(tmpFileName.c_str());
+        return false;
+    }
+    return true;
+}
+
+inline void discard_staged(const std::vector<std::string> &fileNames)
+{
+    for (int i = 0; i < (int)fileNames.size(); i++)
+        std::remove(staged_name(fileNames[i]).c_str());
+}
+
+// renames the staged files in order; they must share one directory
+inline bool commit_files(const std::vector<std::string> &fileNames)
+{
+    if (fileNames.empty())
+        return true;
+    for (int i = 0; i < (int)fileNames.size(); i++)
+        if (std::rename(staged_name(fileNames[i]).c_str(), fileNames[i].c_str()) != 0)
+        {
+            discard_staged(fileNames);
+            return false;
+        }
+
+    std::string::size_type slash = fileNames[0].find_last_of('/');
+    return sync_path(slash == std::string::npos ? "." : fileNames[0].substr(0, slash + 1));
+}
+
+#endif
@@ -5,19 +5,53 @@
 #include <cstdio>
 #include <cstring>
 #include <exception>
+#include <functional>
 #include <string>
 #include <utility>
 #include <vector>
 #ifndef CSV_IO_NO_THREAD
 #include <condition_variable>
+#include <deque>
 #include <mutex>
 #include <thread>
 #endif
+#include <atomic>
 #include <cassert>
 #include <cerrno>
 #include <istream>
 #include <limits>
 #include <memory>
+#include <ostream>
+#include <type_traits>
+#if defined(_WIN32) && !defined(CSV_IO_NO_MMAP)
+#define CSV_IO_NO_MMAP
+#endif
+#ifndef CSV_IO_NO_MMAP
+#include <cstdint>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+#ifndef _WIN32
+#include <sys/stat.h>
+#endif
+#if (defined(__GNUC__) || defined(__clang__)) && defined(__SSE2__) && \
+    !defined(CSV_IO_NO_SIMD)
+#define CSV_IO_SIMD
+#include <cstdint>
+#include <immintrin.h>
+#endif
+#if __cplusplus >= 201703L || (defined(_MSVC_LANG) && _MSVC_LANG >= 201703L)
+#define CSV_IO_STRING_VIEW
+#include <string_view>
+#include <tuple>
+#endif
+#if defined(CSV_IO_STRING_VIEW) && !defined(CSV_IO_NO_FROM_CHARS)
+#include <charconv>
+// only set by libraries whose from_chars also reads floats
+#ifdef __cpp_lib_to_chars
+#define CSV_IO_FROM_CHARS
+#endif
+#endif
 
 namespace io
 {
@@ -109,10 +143,130 @@ namespace io
         };
     } // namespace error
 
+    namespace detail
+    {
+        // Byte scanning used to split lines and columns. With CSV_IO_SIMD the
+        // input is compared 16 bytes at a time with SSE2, or 32 at a time with
+        // AVX2 when the CPU has it, and the matches are read off a bitmask.
+        // Nothing at or past end is read; the bytes after the last whole
+        // block are compared one at a time.
+
+        // first c in [begin, end), or end
+        inline const char *find_byte_scalar(const char *begin, const char *end, char c)
+        {
+            while (begin != end && *begin != c)
+                ++begin;
+            return begin;
+        }
+
+        // first a, b or '\0' in [begin, end), or end
+        inline const char *find_first_of_scalar(const char *begin, const char *end, char a, char b)
+        {
+            while (begin != end && *begin != a && *begin != b && *begin != '\0')
+                ++begin;
+            return begin;
+        }
+
+#ifdef CSV_IO_SIMD
+        inline const char *find_byte_sse2(const char *begin, const char *end, char c)
+        {
+            const __m128i wanted = _mm_set1_epi8(c);
+            for (; end - begin >= 16; begin += 16)
+            {
+                __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i *>(begin));
+                unsigned mask = _mm_movemask_epi8(_mm_cmpeq_epi8(block, wanted));
+                if (mask != 0)
+                    return begin + __builtin_ctz(mask);
+            }
+            return find_byte_scalar(begin, end, c);
+        }
+
+        __attribute__((target("avx2"))) inline const char *
+        find_byte_avx2(const char *begin, const char *end, char c)
+        {
+            const __m256i wanted = _mm256_set1_epi8(c);
+            for (; end - begin >= 32; begin += 32)
+            {
+                __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(begin));
+                unsigned mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(block, wanted));
+                if (mask != 0)
+                    return begin + __builtin_ctz(mask);
+            }
+            return find_byte_sse2(begin, end, c);
+        }
+
+        inline const char *find_first_of_sse2(const char *begin, const char *end, char a, char b)
+        {
+            const __m128i wanted_a = _mm_set1_epi8(a), wanted_b = _mm_set1_epi8(b),
+                          zero = _mm_setzero_si128();
+            for (; end - begin >= 16; begin += 16)
+            {
+                __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i *>(begin));
+                __m128i found = _mm_or_si128(
+                    _mm_or_si128(_mm_cmpeq_epi8(block, wanted_a), _mm_cmpeq_epi8(block, wanted_b)),
+                    _mm_cmpeq_epi8(block, zero));
+                unsigned mask = _mm_movemask_epi8(found);
+                if (mask != 0)
+                    return begin + __builtin_ctz(mask);
+            }
+            return find_first_of_scalar(begin, end, a, b);
+        }
+
+        __attribute__((target("avx2"))) inline const char *
+        find_first_of_avx2(const char *begin, const char *end, char a, char b)
+        {
+            const __m256i wanted_a = _mm256_set1_epi8(a), wanted_b = _mm256_set1_epi8(b),
+                          zero = _mm256_setzero_si256();
+            for (; end - begin >= 32; begin += 32)
+            {
+                __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(begin));
+                __m256i found = _mm256_or_si256(
+                    _mm256_or_si256(_mm256_cmpeq_epi8(block, wanted_a),
+                                    _mm256_cmpeq_epi8(block, wanted_b)),
+                    _mm256_cmpeq_epi8(block, zero));
+                unsigned mask = _mm256_movemask_epi8(found);
+                if (mask != 0)
+                    return begin + __builtin_ctz(mask);
+            }
+            return find_first_of_sse2(begin, end, a, b);
+        }
+
+        inline bool has_avx2()
+        {
+            __builtin_cpu_init();
+            return __builtin_cpu_supports("avx2");
+        }
+
+        inline const char *find_byte(const char *begin, const char *end, char c)
+        {
+            static const bool avx2 = has_avx2();
+            return avx2 ? find_byte_avx2(begin, end, c) : find_byte_sse2(begin, end, c);
+        }
+
+        inline const char *find_first_of(const char *begin, const char *end, char a, char b)
+        {
+            static const bool avx2 = has_avx2();
+            return avx2 ? find_first_of_avx2(begin, end, a, b) : find_first_of_sse2(begin, end, a, b);
+        }
+#else
+        inline const char *find_byte(const char *begin, const char *end, char c)
+        {
+            return find_byte_scalar(begin, end, c);
+        }
+
+        inline const char *find_first_of(const char *begin, const char *end, char a, char b)
+        {
+            return find_first_of_scalar(begin, end, a, b);
+        }
+#endif
+    } // namespace detail
+
     class ByteSourceBase
     {
     public:
         virtual int read(char *buffer, int size) = 0;
+        // bytes left to read, or -1 if that is not known
+        virtual long long remaining_size() const { return -1; }
         virtual ~ByteSourceBase() {}
     };
 
@@ -130,6 +284,17 @@ namespace io
 
             int read(char *buffer, int size) { return std::fread(buffer, 1, size, file); }
 
+            long long remaining_size() const
+            {
+#ifndef _WIN32
+                struct stat info;
+                long position = std::ftell(file);
+                if (position != -1 && fstat(fileno(file), &info) == 0 && S_ISREG(info.st_mode))
+                    return info.st_size - position;
+#endif
+                return -1;
+            }
+
             ~OwningStdIOByteSourceBase() { std::fclose(file); }
 
         private:
@@ -170,6 +335,8 @@ namespace io
                 return to_copy_byte_count;
             }
 
+            long long remaining_size() const { return remaining_byte_count; }
+
             ~NonOwningStringByteSource() {}
 
         private:
@@ -177,89 +344,274 @@ namespace io
             long long remaining_byte_count;
         };
 
+#ifndef CSV_IO_NO_MMAP
+        // Read-only mapping of a whole file. Its pages are only cached copies
+        // of the file, which the kernel can drop and read again at will.
+        class MappedFile
+        {
+        public:
+            // returns nullptr if the file cannot be mapped, a pipe for example
+            static std::unique_ptr<MappedFile> map(int fd)
+            {
+                struct stat info;
+                if (fstat(fd, &info) != 0 || !S_ISREG(info.st_mode))
+                    return nullptr;
+
+                std::unique_ptr<MappedFile> file(new MappedFile);
+                if (info.st_size == 0)
+                    return file;
+                void *data = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+                if (data == MAP_FAILED)
+                    return nullptr;
+                madvise(data, info.st_size, MADV_SEQUENTIAL);
+                file->data = static_cast<char *>(data);
+                file->size = info.st_size;
+                return file;
+            }
+
+            const char *begin() const { return data; }
+            const char *end() const { return data + size; }
+
+            // Takes the pages that lie wholly in [begin, end) out of memory.
+            // The data stays valid: touching it reads it from the file again.
+            void release(const char *begin, const char *end)
+            {
+                static const std::uintptr_t page = sysconf(_SC_PAGESIZE);
+                std::uintptr_t first = (reinterpret_cast<std::uintptr_t>(begin) + page - 1) / page * page;
+                std::uintptr_t last = reinterpret_cast<std::uintptr_t>(end) / page * page;
+                if (first < last)
+                    madvise(reinterpret_cast<void *>(first), last - first, MADV_DONTNEED);
+            }
+
+            ~MappedFile()
+            {
+                if (data != nullptr)
+                    munmap(data, size);
+            }
+
+        private:
+            MappedFile() : data(nullptr), size(0) {}
+
+            char *data;
+            size_t size;
+        };
+#endif
+
 #ifndef CSV_IO_NO_THREAD
-        class AsynchronousReader
+#ifndef CSV_IO_READ_THREADS
+#define CSV_IO_READ_THREADS 2
+#endif
+#ifndef CSV_IO_PREFETCH_DEPTH
+#define CSV_IO_PREFETCH_DEPTH 4
+#endif
+        // The threads that read ahead for every PrefetchReader. They are
+        // started when the first job comes in, so programs whose inputs all
+        // fit in one block never start any.
+        class ReadPool
         {
         public:
-            void init(std::unique_ptr<ByteSourceBase> arg_byte_source)
+            static ReadPool &get()
+            {
+                static ReadPool pool;
+                return pool;
+            }
+
+            void submit(std::function<void()> job)
+            {
+                {
+                    std::lock_guard<std::mutex> guard(lock);
+                    if (workers.empty())
+                        for (int i = 0; i < CSV_IO_READ_THREADS; ++i)
+                            workers.push_back(std::thread([this]
+                                                          { run(); }));
+                    jobs.push_back(std::move(job));
+                }
+                job_added.notify_one();
+            }
+
+            ~ReadPool()
+            {
+                {
+                    std::lock_guard<std::mutex> guard(lock);
+                    stopping = true;
+                }
+                job_added.notify_all();
+                for (std::thread &worker : workers)
+                    worker.join();
+            }
+
+        private:
+            ReadPool() : stopping(false) {}
+
+            void run()
             {
                 std::unique_lock<std::mutex> guard(lock);
+                for (;;)
+                {
+                    job_added.wait(guard, [&]
+                                   { return stopping || !jobs.empty(); });
+                    if (jobs.empty())
+                        return;
+                    std::function<void()> job = std::move(jobs.front());
+                    jobs.pop_front();
+                    guard.unlock();
+                    job();
+                    guard.lock();
+                }
+            }
+
+            std::mutex lock;
+            std::condition_variable job_added;
+            std::deque<std::function<void()>> jobs;
+            std::vector<std::thread> workers;
+            bool stopping;
+        };
+
+        // Reads up to CSV_IO_PREFETCH_DEPTH blocks ahead on the ReadPool.
+        // The blocks form a ring with one producer (the pool thread running
+        // fill, never two at once) and one consumer (the LineReader), handed
+        // over through the produced and consumed counters; the lock is only
+        // taken to sleep when the ring is empty and to (re)schedule fill.
+        class PrefetchReader
+        {
+        public:
+            void init(std::unique_ptr<ByteSourceBase> arg_byte_source)
+            {
                 byte_source = std::move(arg_byte_source);
-                desired_byte_count = -1;
-                termination_requested = false;
-                worker = std::thread([&]
-                                     {
-      std::unique_lock<std::mutex> guard(lock);
-      try {
-        for (;;) {
-          read_requested_condition.wait(guard, [&] {
-            return desired_byte_count != -1 || termination_requested;
-          });
-          if (termination_requested)
-            return;
-
-          read_byte_count = byte_source->read(buffer, desired_byte_count);
-          desired_byte_count = -1;
-          if (read_byte_count == 0)
-            break;
-          read_finished_condition.notify_one();
-        }
-      } catch (...) {
-        read_error = std::current_exception();
-      }
-      read_finished_condition.notify_one(); });
+                block_len = 0;
+                produced = 0;
+                consumed = 0;
+                scheduled = false;
+                source_done = false;
+                stop = false;
             }
 
             bool is_valid() const { return byte_source != nullptr; }
 
             void start_read(char *arg_buffer, int arg_desired_byte_count)
             {
-                std::unique_lock<std::mutex> guard(lock);
                 buffer = arg_buffer;
-                desired_byte_count = arg_desired_byte_count;
-                read_byte_count = -1;
-                read_requested_condition.notify_one();
+                if (block_len == 0)
+                {
+                    block_len = arg_desired_byte_count;
+                    for (Slot &slot : slots)
+                        slot.data.reset(new char[block_len]);
+                }
+                schedule();
             }
 
             int finish_read()
             {
+                unsigned long long next = consumed.load(std::memory_order_relaxed);
+                if (produced.load(std::memory_order_acquire) == next)
+                {
+                    std::unique_lock<std::mutex> guard(lock);
+                    if (source_done && produced.load(std::memory_order_acquire) == next)
+                        return 0; // the end was already handed out
+                    block_ready.wait(guard, [&]
+                                     { return produced.load(std::memory_order_acquire) != next; });
+                }
+
+                Slot &slot = slots[next % CSV_IO_PREFETCH_DEPTH];
+                if (slot.error)
+                    std::rethrow_exception(slot.error); // left in the ring for later calls
+                int read_byte_count = slot.byte_count;
+                std::memcpy(buffer, slot.data.get(), read_byte_count);
+                consumed.store(next + 1, std::memory_order_release);
+                schedule();
+                return read_byte_count;
+            }
+
+            ~PrefetchReader()
+            {
+                if (byte_source == nullptr)
+                    return;
                 std::unique_lock<std::mutex> guard(lock);
-                read_finished_condition.wait(
-                    guard, [&]
-                    { return read_byte_count != -1 || read_error; });
-                if (read_error)
-                    std::rethrow_exception(read_error);
-                else
-                    return read_byte_count;
+                stop = true;
+                fill_done.wait(guard, [&]
+                               { return !scheduled; });
+            }
+
+        private:
+            struct Slot
+            {
+                std::unique_ptr<char[]> data;
+                int byte_count;
+                std::exception_ptr error;
+            };
+
+            bool ring_full() const
+            {
+                return produced.load(std::memory_order_relaxed) -
+                           consumed.load(std::memory_order_acquire) ==
+                       CSV_IO_PREFETCH_DEPTH;
+            }
+
+            void schedule()
+            {
+                {
+                    std::lock_guard<std::mutex> guard(lock);
+                    if (scheduled || source_done || ring_full())
+                        return;
+                    scheduled = true;
+                }
+                ReadPool::get().submit([this]
+                                       { fill(); });
             }
 
-            ~AsynchronousReader()
+            // runs on the pool until the ring is full or the source is done
+            void fill()
             {
-                if (byte_source != nullptr)
+                for (;;)
                 {
+                    while (!stop && !source_done && !ring_full())
                     {
-                        std::unique_lock<std::mutex> guard(lock);
-                        termination_requested = true;
+                        unsigned long long next = produced.load(std::memory_order_relaxed);
+                        Slot &slot = slots[next % CSV_IO_PREFETCH_DEPTH];
+                        bool done;
+                        try
+                        {
+                            slot.byte_count = byte_source->read(slot.data.get(), block_len);
+                            done = slot.byte_count == 0;
+                        }
+                        catch (...)
+                        {
+                            slot.error = std::current_exception();
+                            done = true;
+                        }
+                        {
+                            std::lock_guard<std::mutex> guard(lock);
+                            source_done = done;
+                            produced.store(next + 1, std::memory_order_release);
+                        }
+                        block_ready.notify_one();
                     }
-                    read_requested_condition.notify_one();
-                    worker.join();
+
+                    // The consumer may have freed a slot since the check
+                    // above; it saw scheduled set and left the refill to us.
+                    std::lock_guard<std::mutex> guard(lock);
+                    if (!stop && !source_done && !ring_full())
+                        continue;
+                    scheduled = false;
+                    fill_done.notify_all(); // after this, the reader may be gone
+                    return;
                 }
             }
 
-        private:
             std::unique_ptr<ByteSourceBase> byte_source;
-
-            std::thread worker;
-
-            bool termination_requested;
-            std::exception_ptr read_error;
+            Slot slots[CSV_IO_PREFETCH_DEPTH];
+            int block_len;
             char *buffer;
-            int desired_byte_count;
-            int read_byte_count;
+
+            std::atomic<unsigned long long> produced;
+            std::atomic<unsigned long long> consumed;
+            std::atomic<bool> stop;
+            bool scheduled;   // fill is queued or running
+            bool source_done; // the last block, or an error, is in the ring
 
             std::mutex lock;
-            std::condition_variable read_finished_condition;
-            std::condition_variable read_requested_condition;
+            std::condition_variable block_ready;
+            std::condition_variable fill_done;
         };
 #endif
 
@@ -288,22 +640,47 @@ namespace io
         };
     } // namespace detail
 
+    // writable text for LineReader to split into lines in place
+    struct in_place_range
+    {
+        char *begin;
+        char *end;
+    };
+
+    // block size for a LineReader, instead of the one it picks from the input
+    // size; lines longer than this are an error
+    struct read_block_len
+    {
+        int len;
+    };
+
     class LineReader
     {
     private:
-        static const int block_len = 1 << 20;
+        static const int default_block_len = 1 << 20;
+        static const int min_block_len = 1 << 12;
+
+        int block_len;
         std::unique_ptr<char[]> buffer; // must be constructed before (and thus
                                         // destructed after) the reader!
 #ifdef CSV_IO_NO_THREAD
         detail::SynchronousReader reader;
 #else
-        detail::AsynchronousReader reader;
+        detail::PrefetchReader reader;
 #endif
         int data_begin;
         int data_end;
 
         char file_name[error::max_file_name_length + 1];
         unsigned file_line;
+        char *current_line_end; // the '\0' that ends the last line returned
+
+        // Set when reading a caller's writable range: lines are then scanned
+        // and terminated right there instead of going through buffer.
+        bool in_place = false;
+        char *in_place_begin;
+        char *in_place_end;
+        std::string last_line; // copy of a last line with no '\n' after it
 
         static std::unique_ptr<ByteSourceBase> open_file(const char *file_name)
         {
@@ -323,11 +700,73 @@ namespace io
                 new detail::OwningStdIOByteSourceBase(file));
         }
 
-        void init(std::unique_ptr<ByteSourceBase> byte_source)
+        void init_in_place(char *begin, char *end)
+        {
+            file_line = 0;
+            data_begin = data_end = 0;
+            in_place = true;
+            in_place_begin = begin;
+            in_place_end = end;
+
+            // Ignore UTF-8 BOM
+            if (end - begin >= 3 && begin[0] == '\xEF' && begin[1] == '\xBB' &&
+                begin[2] == '\xBF')
+                in_place_begin += 3;
+        }
+
+        char *next_in_place_line()
+        {
+            if (in_place_begin == in_place_end)
+                return nullptr;
+
+            ++file_line;
+
+            char *line = in_place_begin;
+            char *line_end = line + (detail::find_byte(line, in_place_end, '\n') - line);
+            if (line_end != in_place_end)
+            {
+                *line_end = '\0';
+                in_place_begin = line_end + 1;
+            }
+            else
+            {
+                // There may be no byte past the end of the range to put the
+                // '\0' in, so the last line is copied out if it is missing
+                // its newline.
+                last_line.assign(line, in_place_end);
+                in_place_begin = in_place_end;
+                line = &last_line[0];
+                line_end = line + last_line.size();
+            }
+
+            // handle windows \r\n-line breaks
+            if (line_end != line && line_end[-1] == '\r')
+                *--line_end = '\0';
+            current_line_end = line_end;
+
+            return line;
+        }
+
+        // An input that fits in the buffer is read in one go, and no reader is
+        // started for it. Larger inputs, and those of unknown size, are read
+        // in blocks of the default size.
+        static int block_len_for(long long size)
+        {
+            if (size < 0)
+                return default_block_len;
+            if (size < default_block_len)
+                return std::max(size + 1, (long long)min_block_len); // room for the longest line
+            return default_block_len;
+        }
+
+        void init(std::unique_ptr<ByteSourceBase> byte_source, int chosen_block_len = 0)
         {
             file_line = 0;
 
-            buffer = std::unique_ptr<char[]>(new char[3 * block_len]);
+            block_len = chosen_block_len > 0 ? chosen_block_len
+                                             : block_len_for(byte_source->remaining_size());
+            // the reader hands each next block straight to the second half
+            buffer = std::unique_ptr<char[]>(new char[2 * block_len]);
             data_begin = 0;
             data_end = byte_source->read(buffer.get(), 2 * block_len);
 
@@ -339,7 +778,7 @@ namespace io
             if (data_end == 2 * block_len)
             {
                 reader.init(std::move(byte_source));
-                reader.start_read(buffer.get() + 2 * block_len, block_len);
+                reader.start_read(buffer.get() + block_len, block_len);
             }
         }
 
@@ -374,6 +813,20 @@ namespace io
             init(std::move(byte_source));
         }
 
+        LineReader(const char *file_name,
+                   std::unique_ptr<ByteSourceBase> byte_source, read_block_len len)
+        {
+            set_file_name(file_name);
+            init(std::move(byte_source), len.len);
+        }
+
+        LineReader(const std::string &file_name,
+                   std::unique_ptr<ByteSourceBase> byte_source, read_block_len len)
+        {
+            set_file_name(file_name.c_str());
+            init(std::move(byte_source), len.len);
+        }
+
         LineReader(const char *file_name, const char *data_begin,
                    const char *data_end)
         {
@@ -390,6 +843,20 @@ namespace io
                 data_begin, data_end - data_begin)));
         }
 
+        // Reads the lines of [data_begin, data_end) in place: the range is
+        // written to, and must outlive the reader.
+        LineReader(const char *file_name, in_place_range range)
+        {
+            set_file_name(file_name);
+            init_in_place(range.begin, range.end);
+        }
+
+        LineReader(const std::string &file_name, in_place_range range)
+        {
+            set_file_name(file_name.c_str());
+            init_in_place(range.begin, range.end);
+        }
+
         LineReader(const char *file_name, FILE *file)
         {
             set_file_name(file_name);
@@ -418,6 +885,22 @@ namespace io
                 new detail::NonOwningIStreamByteSource(in)));
         }
 
+        LineReader(const char *file_name, std::istream &in, read_block_len len)
+        {
+            set_file_name(file_name);
+            init(std::unique_ptr<ByteSourceBase>(
+                     new detail::NonOwningIStreamByteSource(in)),
+                 len.len);
+        }
+
+        LineReader(const std::string &file_name, std::istream &in, read_block_len len)
+        {
+            set_file_name(file_name.c_str());
+            init(std::unique_ptr<ByteSourceBase>(
+                     new detail::NonOwningIStreamByteSource(in)),
+                 len.len);
+        }
+
         void set_file_name(const std::string &file_name)
         {
             set_file_name(file_name.c_str());
@@ -427,7 +910,9 @@ namespace io
         {
             if (file_name != nullptr)
             {
-                strncpy(this->file_name, file_name, sizeof(this->file_name));
+                // This call to strncpy has parenthesis around it
+                // to silence the GCC -Wstringop-truncation warning
+                (strncpy(this->file_name, file_name, sizeof(this->file_name)));
                 this->file_name[sizeof(this->file_name) - 1] = '\0';
             }
             else
@@ -442,8 +927,19 @@ namespace io
 
         unsigned get_file_line() const { return file_line; }
 
+        // true if every line returned stays valid as long as the reader,
+        // instead of only until the next call to next_line
+        bool lines_stay_valid() const { return in_place; }
+
+        // The end of the line last returned by next_line, where its '\0' is.
+        // Scanning the line's columns can stop there instead of reading on
+        // to find the '\0'.
+        char *get_line_end() const { return current_line_end; }
+
         char *next_line()
         {
+            if (in_place)
+                return next_in_place_line();
             if (data_begin == data_end)
                 return nullptr;
 
@@ -459,18 +955,26 @@ namespace io
                 data_end -= block_len;
                 if (reader.is_valid())
                 {
-                    data_end += reader.finish_read();
-                    std::memcpy(buffer.get() + block_len, buffer.get() + 2 * block_len,
-                                block_len);
-                    reader.start_read(buffer.get() + 2 * block_len, block_len);
+                    try
+                    {
+                        data_end += reader.finish_read();
+                    }
+                    catch (...)
+                    {
+                        // The second half is still there, so put it back: the
+                        // next call reads it again and gets the same error,
+                        // instead of running out of lines as if at the end.
+                        data_begin += block_len;
+                        data_end += block_len;
+                        --file_line;
+                        throw;
+                    }
+                    reader.start_read(buffer.get() + block_len, block_len);
                 }
             }
 
-            int line_end = data_begin;
-            while (line_end != data_end && buffer[line_end] != '\n')
-            {
-                ++line_end;
-            }
+            int line_end = detail::find_byte(buffer.get() + data_begin, buffer.get() + data_end, '\n') -
+                           buffer.get();
 
             if (line_end - data_begin + 1 > block_len)
             {
@@ -493,8 +997,9 @@ namespace io
             }
 
             // handle windows \r\n-line breaks
+            current_line_end = buffer.get() + line_end;
             if (line_end != data_begin && buffer[line_end - 1] == '\r')
-                buffer[line_end - 1] = '\0';
+                *--current_line_end = '\0';
 
             char *ret = buffer.get() + data_begin;
             data_begin = line_end + 1;
@@ -701,6 +1206,21 @@ namespace io
                     column_content, column_name, file_name, file_line);
             }
         };
+
+        struct column_not_writable : base,
+                                     with_file_name,
+                                     with_file_line,
+                                     with_column_name,
+                                     with_column_content
+        {
+            void format_error_message() const override
+            {
+                std::snprintf(
+                    error_message_buffer, sizeof(error_message_buffer),
+                    R"(The content "%s" of column "%s" can not be written to file "%s" in line "%d" so that it reads back the same.)",
+                    column_content, column_name, file_name, file_line);
+            }
+        };
     } // namespace error
 
     using ignore_column = unsigned int;
@@ -722,6 +1242,8 @@ namespace io
         }
 
     public:
+        static bool is_trimmed(char c) { return is_trim_char(c, trim_char_list...); }
+
         static void trim(char *&str_begin, char *&str_end)
         {
             while (str_begin != str_end && is_trim_char(*str_begin, trim_char_list...))
@@ -789,39 +1311,52 @@ namespace io
     template <char sep>
     struct no_quote_escape
     {
-        static const char *find_next_column_end(const char *col_begin)
+        static const char separator = sep;
+
+        // line_end is the '\0' that ends the line
+        static const char *find_next_column_end(const char *col_begin, const char *line_end)
         {
-            while (*col_begin != sep && *col_begin != '\0')
-                ++col_begin;
-            return col_begin;
+            return detail::find_first_of(col_begin, line_end, sep, sep);
         }
 
         static void unescape(char *&, char *&) {}
+
+        // Appends the column as it goes into the file, or returns false if
+        // it would not read back the same. must_quote is set for columns that
+        // the trim policy would change.
+        static bool escape(std::string &out, const char *begin, const char *end,
+                           bool must_quote)
+        {
+            for (const char *c = begin; c != end; ++c)
+                if (*c == sep || *c == '\n' || *c == '\r' || *c == '\0')
+                    return false;
+            if (must_quote)
+                return false;
+            out.append(begin, end);
+            return true;
+        }
     };
 
     template <char sep, char quote>
     struct double_quote_escape
     {
-        static const char *find_next_column_end(const char *col_begin)
+        static const char separator = sep;
+
+        static const char *find_next_column_end(const char *col_begin, const char *line_end)
         {
-            while (*col_begin != sep && *col_begin != '\0')
+            for (;;)
+            {
+                col_begin = detail::find_first_of(col_begin, line_end, sep, quote);
                 if (*col_begin != quote)
-                    ++col_begin;
-                else
+                    return col_begin;
+                do
                 {
-                    do
-                    {
-                        ++col_begin;
-                        while (*col_begin != quote)
-                        {
-                            if (*col_begin == '\0')
-                                throw error::escaped_string_not_closed();
-                            ++col_begin;
-                        }
-                        ++col_begin;
-                    } while (*col_begin == quote);
-                }
-            return col_begin;
+                    col_begin = detail::find_first_of(col_begin + 1, line_end, quote, quote);
+                    if (*col_begin == '\0')
+                        throw error::escaped_string_not_closed();
+                    ++col_begin;
+                } while (*col_begin == quote);
+            }
         }
 
         static void unescape(char *&col_begin, char *&col_end)
@@ -847,6 +1382,58 @@ namespace io
                 }
             }
         }
+
+        // see no_quote_escape::escape; only line breaks and '\0' cannot be
+        // quoted
+        static bool escape(std::string &out, const char *begin, const char *end,
+                           bool must_quote)
+        {
+            for (const char *c = begin; c != end; ++c)
+            {
+                if (*c == '\n' || *c == '\r' || *c == '\0')
+                    return false;
+                if (*c == sep || *c == quote)
+                    must_quote = true;
+            }
+            if (!must_quote)
+            {
+                out.append(begin, end);
+                return true;
+            }
+            out += quote;
+            for (const char *c = begin; c != end; ++c)
+            {
+                if (*c == quote)
+                    out += quote;
+                out += *c;
+            }
+            out += quote;
+            return true;
+        }
+    };
+
+    // Reads what double_quote_escape writes, and also files written with no
+    // quoting at all: a quote only opens a quoted column at the very start of
+    // the column, and one that is never closed is an ordinary character. A
+    // column such as 17" rims therefore reads as it is.
+    template <char sep, char quote>
+    struct lenient_double_quote_escape : double_quote_escape<sep, quote>
+    {
+        static const char *find_next_column_end(const char *col_begin, const char *line_end)
+        {
+            if (*col_begin == quote)
+            {
+                for (const char *c = col_begin + 1;; c += 2)
+                {
+                    c = detail::find_first_of(c, line_end, quote, quote);
+                    if (*c == '\0')
+                        break;
+                    if (c[1] != quote) // the closing quote
+                        return detail::find_first_of(c + 1, line_end, sep, sep);
+                }
+            }
+            return detail::find_first_of(col_begin, line_end, sep, sep);
+        }
     };
 
     struct throw_on_overflow
@@ -894,14 +1481,15 @@ namespace io
     namespace detail
     {
         template <class quote_policy>
-        void chop_next_column(char *&line, char *&col_begin, char *&col_end)
+        void chop_next_column(char *&line, const char *line_end, char *&col_begin,
+                              char *&col_end)
         {
             assert(line != nullptr);
 
             col_begin = line;
             // the col_begin + (... - col_begin) removes the constness
-            col_end =
-                col_begin + (quote_policy::find_next_column_end(col_begin) - col_begin);
+            col_end = col_begin +
+                      (quote_policy::find_next_column_end(col_begin, line_end) - col_begin);
 
             if (*col_end == '\0')
             {
@@ -915,7 +1503,7 @@ namespace io
         }
 
         template <class trim_policy, class quote_policy>
-        void parse_line(char *line, char **sorted_col,
+        void parse_line(char *line, const char *line_end, char **sorted_col,
                         const std::vector<int> &col_order)
         {
             for (int i : col_order)
@@ -923,7 +1511,7 @@ namespace io
                 if (line == nullptr)
                     throw ::io::error::too_few_columns();
                 char *col_begin, *col_end;
-                chop_next_column<quote_policy>(line, col_begin, col_end);
+                chop_next_column<quote_policy>(line, line_end, col_begin, col_end);
 
                 if (i != -1)
                 {
@@ -938,7 +1526,7 @@ namespace io
         }
 
         template <unsigned column_count, class trim_policy, class quote_policy>
-        void parse_header_line(char *line, std::vector<int> &col_order,
+        void parse_header_line(char *line, const char *line_end, std::vector<int> &col_order,
                                const std::string *col_name,
                                ignore_column ignore_policy)
         {
@@ -949,7 +1537,7 @@ namespace io
             while (line)
             {
                 char *col_begin, *col_end;
-                chop_next_column<quote_policy>(line, col_begin, col_end);
+                chop_next_column<quote_policy>(line, line_end, col_begin, col_end);
 
                 trim_policy::trim(col_begin, col_end);
                 quote_policy::unescape(col_begin, col_end);
@@ -1020,9 +1608,38 @@ namespace io
         template <class overflow_policy>
         void parse(char *col, char *&x) { x = col; }
 
+#ifdef CSV_IO_STRING_VIEW
+        template <class overflow_policy>
+        void parse(char *col, std::string_view &x)
+        {
+            x = col;
+        }
+#endif
+
+        // With CSV_IO_FROM_CHARS numbers are read with std::from_chars, which
+        // rounds floats correctly. Whatever it does not take as a whole (an
+        // empty column, a leading '+', a ',' decimal separator, an overflow or
+        // a bad digit) goes through the loops below, so results and errors
+        // stay as they were.
+        template <class T>
+        bool parse_number_fast(const char *col, T &x)
+        {
+#ifdef CSV_IO_FROM_CHARS
+            const char *end = col + std::strlen(col);
+            std::from_chars_result result = std::from_chars(col, end, x);
+            return result.ec == std::errc() && result.ptr == end;
+#else
+            (void)col;
+            (void)x;
+            return false;
+#endif
+        }
+
         template <class overflow_policy, class T>
         void parse_unsigned_integer(const char *col, T &x)
         {
+            if (parse_number_fast(col, x))
+                return;
             x = 0;
             while (*col != '\0')
             {
@@ -1071,6 +1688,8 @@ namespace io
         template <class overflow_policy, class T>
         void parse_signed_integer(const char *col, T &x)
         {
+            if (parse_number_fast(col, x))
+                return;
             if (*col == '-')
             {
                 ++col;
@@ -1126,7 +1745,43 @@ namespace io
         }
 
         template <class T>
-        void parse_float(const char *col, T &x)
+        bool parse_plain_decimal(const char *, T &)
+        {
+            return false;
+        }
+
+        // Clinger's fast path, for prices and the like: a plain decimal with
+        // at most 15 digits is an exact double divided by an exact power of
+        // ten, and that single division is correctly rounded.
+        inline bool parse_plain_decimal(const char *col, double &x)
+        {
+            static const double powers[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7,
+                                            1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15};
+            bool is_neg = *col == '-';
+            if (is_neg)
+                ++col;
+
+            unsigned long long mantissa = 0; // may wrap, but is then not used
+            int digits = 0, decimals = 0;
+            for (; '0' <= *col && *col <= '9'; ++col, ++digits)
+                mantissa = 10 * mantissa + (*col - '0');
+            if (*col == '.')
+                for (++col; '0' <= *col && *col <= '9'; ++col, ++decimals)
+                    mantissa = 10 * mantissa + (*col - '0');
+            if (*col != '\0' || digits + decimals == 0 || digits + decimals > 15)
+                return false;
+
+            x = (double)mantissa / powers[decimals];
+            if (is_neg)
+                x = -x;
+            return true;
+        }
+
+        // The digit by digit loops floats were read with before from_chars
+        // and the decimal fast path. They can be off by a few ulps, but take
+        // ',' decimals and a leading '+'.
+        template <class T>
+        void parse_float_loops(const char *col, T &x)
         {
             bool is_neg = false;
             if (*col == '-')
@@ -1205,6 +1860,17 @@ namespace io
                 x = -x;
         }
 
+        template <class T>
+        void parse_float(const char *col, T &x)
+        {
+            // from_chars would also take "inf" and "nan"
+            const char *digits = *col == '-' ? col + 1 : col;
+            if ((('0' <= *digits && *digits <= '9') || *digits == '.') &&
+                (parse_plain_decimal(col, x) || parse_number_fast(col, x)))
+                return;
+            parse_float_loops(col, x);
+        }
+
         template <class overflow_policy>
         void parse(char *col, float &x)
         {
@@ -1237,6 +1903,67 @@ namespace io
 
     } // namespace detail
 
+#ifdef CSV_IO_STRING_VIEW
+    // Owns copies of columns that have to outlive the line they were read
+    // from. The copies are carved out of large blocks, which are only given
+    // back by clear() or the destructor, and each one is followed by a '\0'.
+    class RowArena
+    {
+    private:
+        static constexpr std::size_t block_len = 1 << 16;
+        std::vector<std::unique_ptr<char[]>> blocks;
+        char *free_begin = nullptr;
+        char *free_end = nullptr;
+
+    public:
+        RowArena() = default;
+        RowArena(const RowArena &) = delete;
+        RowArena &operator=(const RowArena &) = delete;
+        RowArena(RowArena &&) = default;
+        RowArena &operator=(RowArena &&) = default;
+
+        std::string_view keep(std::string_view str)
+        {
+            std::size_t len = str.size() + 1;
+            if ((std::size_t)(free_end - free_begin) < len)
+            {
+                std::size_t size = std::max(len, block_len);
+                blocks.emplace_back(new char[size]);
+                free_begin = blocks.back().get();
+                free_end = free_begin + size;
+            }
+            char *copy = free_begin;
+            std::memcpy(copy, str.data(), str.size());
+            copy[str.size()] = '\0';
+            free_begin += len;
+            return std::string_view(copy, str.size());
+        }
+
+        void clear()
+        {
+            blocks.clear();
+            free_begin = free_end = nullptr;
+        }
+    };
+
+    namespace detail
+    {
+        template <class T>
+        void keep_column(RowArena &, T &) {}
+
+        inline void keep_column(RowArena &arena, std::string_view &x)
+        {
+            x = arena.keep(x);
+        }
+
+        inline void keep_column(RowArena &arena, const char *&x)
+        {
+            if (x != nullptr)
+                x = arena.keep(x).data();
+        }
+    } // namespace detail
+#endif
+
     template <unsigned column_count, class trim_policy = trim_chars<' ', '\t'>,
               class quote_policy = no_quote_escape<','>,
               class overflow_policy = throw_on_overflow,
@@ -1298,7 +2025,7 @@ namespace io
                 } while (comment_policy::is_comment(line));
 
                 detail::parse_header_line<column_count, trim_policy, quote_policy>(
-                    line, col_order, column_names, ignore_policy);
+                    line, in.get_line_end(), col_order, column_names, ignore_policy);
             }
             catch (error::with_file_name &err)
             {
@@ -1321,6 +2048,14 @@ namespace io
                 col_order[i] = i;
         }
 
+        // takes over the columns found by other.read_header, for a reader
+        // that starts after the header line
+        void copy_header(const CSVReader &other)
+        {
+            std::copy(other.column_names, other.column_names + column_count, column_names);
+            col_order = other.col_order;
+        }
+
         bool has_column(const std::string &name) const
         {
             return col_order.end() !=
@@ -1346,6 +2081,10 @@ namespace io
 
         unsigned get_file_line() const { return in.get_file_line(); }
 
+        // true if const char * and string_view columns stay valid as long as
+        // the reader, instead of only until the next read_row
+        bool rows_stay_valid() const { return in.lines_stay_valid(); }
+
     private:
         void parse_helper(std::size_t) {}
 
@@ -1396,7 +2135,8 @@ namespace io
                             return false;
                     } while (comment_policy::is_comment(line));
 
-                    detail::parse_line<trim_policy, quote_policy>(line, row, col_order);
+                    detail::parse_line<trim_policy, quote_policy>(line, in.get_line_end(), row,
+                                                                  col_order);
 
                     parse_helper(0, cols...);
                 }
@@ -1414,6 +2154,464 @@ namespace io
 
             return true;
         }
+
+#ifdef CSV_IO_STRING_VIEW
+        // Appends up to max_rows rows to rows and returns how many were read,
+        // 0 at the end of the file. string_view and const char * columns point
+        // into the file when rows_stay_valid(), and into arena otherwise, so
+        // they stay valid as long as both the reader and the arena do.
+        template <class... ColType>
+        std::size_t read_rows(std::vector<std::tuple<ColType...>> &rows,
+                              std::size_t max_rows, RowArena &arena)
+        {
+            return read_rows_helper(rows, max_rows, arena,
+                                    std::index_sequence_for<ColType...>());
+        }
+
+    private:
+        template <class... ColType, std::size_t... I>
+        std::size_t read_rows_helper(std::vector<std::tuple<ColType...>> &rows,
+                                     std::size_t max_rows, RowArena &arena,
+                                     std::index_sequence<I...>)
+        {
+            bool keep = !rows_stay_valid();
+            std::size_t count = 0;
+            for (; count < max_rows; ++count)
+            {
+                std::tuple<ColType...> row;
+                if (!read_row(std::get<I>(row)...))
+                    break;
+                if (keep)
+                    (detail::keep_column(arena, std::get<I>(row)), ...);
+                rows.push_back(std::move(row));
+            }
+            return count;
+        }
+#endif
+    };
+
+    ////////////////////////////////////////////////////////////////////////////
+    //                             ParallelCSVReader                          //
+    ////////////////////////////////////////////////////////////////////////////
+
+    // Reads a whole file with several threads. The rows after the header are
+    // cut into chunks at line ends, and every chunk is parsed by its own
+    // CSVReader on a worker thread; the results come back in file order.
+    //
+    // A quoted column never spans lines (LineReader splits the lines before
+    // the columns are looked at), so every '\n' is a safe place to cut,
+    // whatever the quote policy.
+    template <unsigned column_count, class trim_policy = trim_chars<' ', '\t'>,
+              class quote_policy = no_quote_escape<','>,
+              class overflow_policy = throw_on_overflow,
+              class comment_policy = no_comment>
+    class ParallelCSVReader
+    {
+    public:
+        typedef CSVReader<column_count, trim_policy, quote_policy, overflow_policy,
+                          comment_policy>
+            ChunkReader;
+
+    private:
+        static const long long min_chunk_len = 1 << 20;
+
+        std::string file_name;
+        unsigned thread_count;
+#ifndef CSV_IO_NO_MMAP
+        std::unique_ptr<detail::MappedFile> mapping;
+#endif
+        std::vector<char> contents; // when the file cannot be mapped
+        const char *data_begin;
+        const char *data_end;
+        std::vector<char> header_text; // read in place by header
+        std::unique_ptr<ChunkReader> header;
+        unsigned header_lines;
+
+        void load(FILE *file)
+        {
+#ifndef CSV_IO_NO_MMAP
+            mapping = detail::MappedFile::map(fileno(file));
+            if (mapping != nullptr)
+            {
+                std::fclose(file);
+                data_begin = mapping->begin();
+                data_end = mapping->end();
+                return;
+            }
+#endif
+            char block[1 << 16];
+            int count;
+            while ((count = std::fread(block, 1, sizeof(block), file)) > 0)
+                contents.insert(contents.end(), block, block + count);
+            std::fclose(file);
+            data_begin = contents.data();
+            data_end = data_begin + contents.size();
+        }
+
+        struct Chunk
+        {
+            const char *begin;
+            const char *end;
+            std::vector<char> text; // copy of [begin, end) read in place
+            unsigned lines;
+            std::exception_ptr error;
+            bool done;
+        };
+
+        std::vector<Chunk> split() const
+        {
+            long long size = data_end - data_begin;
+            long long chunk_len = size / (4 * (long long)thread_count);
+            if (chunk_len < min_chunk_len)
+                chunk_len = min_chunk_len;
+
+            std::vector<Chunk> chunks;
+            const char *begin = data_begin;
+            while (begin != data_end)
+            {
+                const char *end = data_end;
+                if (data_end - begin > chunk_len)
+                {
+                    end = detail::find_byte(begin + chunk_len, data_end, '\n');
+                    if (end != data_end)
+                        ++end;
+                }
+                Chunk chunk = {begin, end, std::vector<char>(), 0, nullptr, false};
+                chunks.push_back(chunk);
+                begin = end;
+            }
+            return chunks;
+        }
+
+    public:
+        ParallelCSVReader() = delete;
+        ParallelCSVReader(const ParallelCSVReader &) = delete;
+        ParallelCSVReader &operator=(const ParallelCSVReader &) = delete;
+
+        // thread_count 0 means one thread per core
+        explicit ParallelCSVReader(const std::string &file_name, unsigned thread_count = 0)
+            : file_name(file_name), thread_count(thread_count), header_lines(0)
+        {
+#ifdef CSV_IO_NO_THREAD
+            this->thread_count = 1;
+#else
+            if (this->thread_count == 0)
+                this->thread_count = std::max(1u, std::thread::hardware_concurrency());
+#endif
+            FILE *file = std::fopen(file_name.c_str(), "rb");
+            if (file == 0)
+            {
+                int x = errno;
+                error::can_not_open_file err;
+                err.set_errno(x);
+                err.set_file_name(file_name.c_str());
+                throw err;
+            }
+            load(file);
+        }
+
+        template <class... ColNames>
+        void read_header(ignore_column ignore_policy, ColNames... cols)
+        {
+            // the header line, and any comment lines before it
+            const char *header_end = data_begin;
+            do
+            {
+                const char *line = header_end;
+                header_end = detail::find_byte(line, data_end, '\n');
+                if (header_end != data_end)
+                    ++header_end;
+                ++header_lines;
+                if (!comment_policy::is_comment(std::string(line, header_end).c_str()))
+                    break;
+            } while (header_end != data_end);
+
+            header_text.assign(data_begin, header_end);
+            header.reset(new ChunkReader(file_name, in_place_range{header_text.data(),
+                                                                   header_text.data() + header_text.size()}));
+            header->read_header(ignore_policy, cols...);
+            data_begin = header_end;
+        }
+
+        // Calls read(reader, rows) for every chunk, on the worker threads,
+        // with a ChunkReader over the chunk and an empty std::vector<Row> to
+        // fill. Then calls consume(rows) with the rows of every chunk, on the
+        // calling thread and in file order. An error is thrown once the rows
+        // before it are consumed, with its line number in the whole file.
+        //
+        // Every chunk is copied out of the file and read in place, so const
+        // char * and string_view columns can go into the rows as they are:
+        // they stay valid until consume returns. The copy is then freed, and
+        // a mapped file's pages are released once copied, so only the
+        // chunks in flight are in memory.
+        template <class Row, class Read, class Consume>
+        void read_batches(Read read, Consume consume)
+        {
+            std::vector<Chunk> chunks = split();
+            std::vector<std::vector<Row>> rows(chunks.size());
+            // kept until the rows are consumed, for the last line of the file
+            // that its reader had to copy
+            std::vector<std::unique_ptr<ChunkReader>> readers(chunks.size());
+
+            std::atomic<size_t> next_chunk(0);
+            std::atomic<bool> stop(false);
+            // mark_done(chunk) tells the calling thread the chunk is read
+            auto work = [&](std::function<void(Chunk &)> mark_done)
+            {
+                for (size_t i; !stop && (i = next_chunk++) < chunks.size();)
+                {
+                    Chunk &chunk = chunks[i];
+                    try
+                    {
+                        chunk.text.assign(chunk.begin, chunk.end);
+#ifndef CSV_IO_NO_MMAP
+                        if (mapping != nullptr)
+                            mapping->release(chunk.begin, chunk.end);
+#endif
+                        readers[i].reset(new ChunkReader(file_name, in_place_range{chunk.text.data(),
+                                                                                   chunk.text.data() + chunk.text.size()}));
+                        ChunkReader &in = *readers[i];
+                        if (header != nullptr)
+                            in.copy_header(*header);
+                        read(in, rows[i]);
+                        chunk.lines = in.get_file_line();
+                    }
+                    catch (...)
+                    {
+                        chunk.error = std::current_exception();
+                    }
+                    mark_done(chunk);
+                }
+            };
+
+            unsigned lines_before = header_lines;
+            auto deliver = [&](size_t i)
+            {
+                // the rows before an error are kept, as with a single reader
+                consume(rows[i]);
+                std::vector<Row>().swap(rows[i]);
+                readers[i].reset();
+                std::vector<char>().swap(chunks[i].text);
+                if (chunks[i].error)
+                {
+                    try
+                    {
+                        std::rethrow_exception(chunks[i].error);
+                    }
+                    catch (error::with_file_line &err)
+                    {
+                        err.set_file_line(err.file_line + lines_before);
+                        throw;
+                    }
+                }
+                lines_before += chunks[i].lines;
+            };
+
+            unsigned worker_count = std::min<size_t>(thread_count, chunks.size());
+            if (worker_count <= 1)
+            {
+                work([](Chunk &chunk)
+                     { chunk.done = true; });
+                for (size_t i = 0; i < chunks.size(); ++i)
+                    deliver(i);
+                return;
+            }
+
+#ifndef CSV_IO_NO_THREAD
+            std::mutex lock;
+            std::condition_variable chunk_done;
+            std::vector<std::thread> workers;
+            auto mark_done = [&](Chunk &chunk)
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                chunk.done = true;
+                chunk_done.notify_all();
+            };
+            for (unsigned i = 0; i < worker_count; ++i)
+                workers.push_back(std::thread(work, mark_done));
+
+            try
+            {
+                for (size_t i = 0; i < chunks.size(); ++i)
+                {
+                    {
+                        std::unique_lock<std::mutex> guard(lock);
+                        chunk_done.wait(guard, [&]
+                                        { return chunks[i].done; });
+                    }
+                    deliver(i);
+                }
+            }
+            catch (...)
+            {
+                stop = true;
+                for (unsigned i = 0; i < workers.size(); ++i)
+                    workers[i].join();
+                throw;
+            }
+            for (unsigned i = 0; i < workers.size(); ++i)
+                workers[i].join();
+#endif
+        }
+    };
+
+    ////////////////////////////////////////////////////////////////////////////
+    //                                 CSVWriter                              //
+    ////////////////////////////////////////////////////////////////////////////
+
+    // Writes rows that a CSVReader with the same policies reads back as they
+    // were: columns are quoted as quote_policy needs, and numbers are written
+    // with std::to_chars, the shortest text that reads back to the same
+    // value, whatever the locale. Rows are gathered in a large buffer that
+    // goes to the stream whenever it fills up, and by flush(); failed writes
+    // show in the stream's state.
+    template <unsigned column_count, class trim_policy = trim_chars<' ', '\t'>,
+              class quote_policy = no_quote_escape<','>>
+    class CSVWriter
+    {
+    private:
+        static const std::size_t block_len = 1 << 20;
+
+        std::ostream &out;
+        std::string buffer;
+        char file_name[error::max_file_name_length + 1];
+        unsigned file_line;
+
+        std::string column_names[column_count];
+        unsigned column; // the one being written
+
+        void write_text(const char *begin, const char *end)
+        {
+            if (column != 0)
+                buffer += quote_policy::separator;
+            bool must_quote = begin != end && (trim_policy::is_trimmed(*begin) ||
+                                               trim_policy::is_trimmed(end[-1]));
+            if (!quote_policy::escape(buffer, begin, end, must_quote))
+            {
+                error::column_not_writable err;
+                err.set_file_name(file_name);
+                err.set_file_line(file_line);
+                err.set_column_name(column_names[column].c_str());
+                err.set_column_content(std::string(begin, end).c_str());
+                throw err;
+            }
+            ++column;
+        }
+
+        void write_value(const std::string &x) { write_text(x.data(), x.data() + x.size()); }
+        void write_value(const char *x) { write_text(x, x + std::strlen(x)); }
+#ifdef CSV_IO_STRING_VIEW
+        void write_value(std::string_view x) { write_text(x.data(), x.data() + x.size()); }
+#endif
+        void write_value(char x) { write_text(&x, &x + 1); }
+
+        template <class T>
+        typename std::enable_if<std::is_arithmetic<T>::value &&
+                                !std::is_same<T, bool>::value>::type
+        write_value(T x)
+        {
+            char text[64];
+#ifdef CSV_IO_FROM_CHARS
+            char *end = std::to_chars(text, text + sizeof(text), x).ptr;
+#else
+            char *end = text + format_number(text, sizeof(text), x);
+#endif
+            write_text(text, end);
+        }
+
+#ifndef CSV_IO_FROM_CHARS
+        template <class T>
+        static int format_number(char *text, int size, T x)
+        {
+            if (std::is_floating_point<T>::value)
+                return std::snprintf(text, size, "%.*Lg",
+                                     std::numeric_limits<T>::max_digits10, (long double)x);
+            if (std::is_signed<T>::value)
+                return std::snprintf(text, size, "%lld", (long long)x);
+            return std::snprintf(text, size, "%llu", (unsigned long long)x);
+        }
+#endif
+
+        void write_columns() {}
+
+        template <class T, class... ColType>
+        void write_columns(const T &col, const ColType &...cols)
+        {
+            write_value(col);
+            write_columns(cols...);
+        }
+
+    public:
+        CSVWriter() = delete;
+        CSVWriter(const CSVWriter &) = delete;
+        CSVWriter &operator=(const CSVWriter &) = delete;
+
+        CSVWriter(const std::string &file_name, std::ostream &out)
+            : out(out), file_line(0), column(0)
+        {
+            (std::strncpy(this->file_name, file_name.c_str(), error::max_file_name_length));
+            this->file_name[error::max_file_name_length] = '\0';
+            for (unsigned i = 1; i <= column_count; ++i)
+                column_names[i - 1] = "col" + std::to_string(i);
+        }
+
+        template <class... ColNames>
+        void write_header(ColNames... cols)
+        {
+            static_assert(sizeof...(ColNames) >= column_count,
+                          "not enough column names specified");
+            static_assert(sizeof...(ColNames) <= column_count,
+                          "too many column names specified");
+            std::string names[column_count] = {cols...};
+            std::copy(names, names + column_count, column_names);
+            write_row(cols...);
+        }
+
+        template <class... ColType>
+        void write_row(const ColType &...cols)
+        {
+            static_assert(sizeof...(ColType) >= column_count,
+                          "not enough columns specified");
+            static_assert(sizeof...(ColType) <= column_count,
+                          "too many columns specified");
+            ++file_line;
+            column = 0;
+            std::size_t row_begin = buffer.size();
+            try
+            {
+                write_columns(cols...);
+            }
+            catch (...)
+            {
+                buffer.resize(row_begin); // no half rows
+                throw;
+            }
+            buffer += '\n';
+            if (buffer.size() >= block_len)
+                flush();
+        }
+
+#ifdef CSV_IO_STRING_VIEW
+        // writes the rows read by CSVReader::read_rows, for example
+        template <class... ColType>
+        void write_rows(const std::vector<std::tuple<ColType...>> &rows)
+        {
+            for (const std::tuple<ColType...> &row : rows)
+                std::apply([this](const ColType &...cols)
+                           { write_row(cols...); },
+                           row);
+        }
+#endif
+
+        void flush()
+        {
+            out.write(buffer.data(), buffer.size());
+            buffer.clear();
+        }
+
+        unsigned get_file_line() const { return file_line; }
+
+        ~CSVWriter() { flush(); }
     };
 } // namespace io
-#endif
\ No newline at end of file
+#endif
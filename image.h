@@ -0,0 +1,241 @@
+#ifndef IMAGE_H
+#define IMAGE_H
+
+#include <cstdio>
+#include <cstring>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include <sys/stat.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+// Binary image of the data, read with a single mmap at startup instead of
+// parsing the CSV files. It is laid out as
+//
+//   ImageHeader | sections of fixed-width records | string heap
+//
+// Every section starts on an 8 byte boundary, and records refer to their
+// strings by offset and length in the heap. Numbers are stored in the byte
+// order of the machine that wrote the image; bump IMAGE_VERSION whenever a
+// record changes.
+
+const char IMAGE_MAGIC[8] = {'C', 'R', 'I', 'M', 'A', 'G', 'E', '\0'};
+const uint32_t IMAGE_VERSION = 1;
+
+// identifies one version of a file, to tell whether it changed since
+struct ImageFileStamp
+{
+    uint64_t size;
+    int64_t modified; // in nanoseconds, where the system keeps them
+    uint64_t inode;
+};
+
+struct ImageString
+{
+    uint32_t offset;
+    uint32_t length;
+};
+
+struct ImageSection
+{
+    uint64_t offset;
+    uint64_t count;
+};
+
+struct ImageHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t headerSize;
+    uint64_t fileSize;
+    ImageFileStamp sources[3]; // the CSV files the image was written with
+    ImageSection sections[8];  // meaning is up to the caller
+    ImageSection strings;      // count is the heap size in bytes
+};
+
+inline ImageFileStamp image_stamp(const char *fileName)
+{
+    ImageFileStamp stamp = {};
+    struct stat info;
+    if (stat(fileName, &info) == 0)
+    {
+        stamp.size = info.st_size;
+        // a file rewritten within the same second, at the same size, must
+        // not look unchanged
+#if defined(_WIN32)
+        stamp.modified = (int64_t)info.st_mtime * 1000000000;
+#elif defined(__APPLE__)
+        stamp.modified = (int64_t)info.st_mtimespec.tv_sec * 1000000000 + info.st_mtimespec.tv_nsec;
+#else
+        stamp.modified = (int64_t)info.st_mtim.tv_sec * 1000000000 + info.st_mtim.tv_nsec;
+#endif
+        stamp.inode = info.st_ino;
+    }
+    return stamp;
+}
+
+inline bool image_sameStamp(const ImageFileStamp &a, const ImageFileStamp &b)
+{
+    return a.size == b.size && a.modified == b.modified && a.inode == b.inode;
+}
+
+// An image under construction: the header, the sections and the string heap
+// are built apart and joined by image_finish.
+struct ImageBuilder
+{
+    ImageHeader header;
+    std::string body;
+    std::string strings;
+};
+
+inline void image_begin(ImageBuilder &builder)
+{
+    std::memset(&builder.header, 0, sizeof(builder.header));
+    std::memcpy(builder.header.magic, IMAGE_MAGIC, sizeof(IMAGE_MAGIC));
+    builder.header.version = IMAGE_VERSION;
+    builder.header.headerSize = sizeof(ImageHeader);
+    builder.body.clear();
+    builder.strings.clear();
+}
+
+inline ImageString image_addString(ImageBuilder &builder, const std::string &str)
+{
+    ImageString ref = {(uint32_t)builder.strings.size(), (uint32_t)str.size()};
+    builder.strings += str;
+    return ref;
+}
+
+template <class T>
+void image_addSection(ImageBuilder &builder, int section, const std::vector<T> &records)
+{
+    builder.body.resize((builder.body.size() + 7) / 8 * 8, '\0');
+    builder.header.sections[section].offset = sizeof(ImageHeader) + builder.body.size();
+    builder.header.sections[section].count = records.size();
+    if (!records.empty())
+        builder.body.append((const char *)records.data(), records.size() * sizeof(T));
+}
+
+// returns the whole image, ready to be written out
+inline std::string image_finish(ImageBuilder &builder)
+{
+    builder.body.resize((builder.body.size() + 7) / 8 * 8, '\0');
+    builder.header.strings.offset = sizeof(ImageHeader) + builder.body.size();
+    builder.header.strings.count = builder.strings.size();
+    builder.header.fileSize = builder.header.strings.offset + builder.strings.size();
+
+    std::string image((const char *)&builder.header, sizeof(ImageHeader));
+    image += builder.body;
+    image += builder.strings;
+    return image;
+}
+
+struct MappedImage
+{
+    const char *data;
+    size_t size;
+};
+
+// maps the whole file read-only; returns false if it cannot be opened
+inline bool image_map(const char *fileName, MappedImage &image)
+{
+    image.data = NULL;
+    image.size = 0;
+#ifndef _WIN32
+    int fd = open(fileName, O_RDONLY);
+    if (fd == -1)
+        return false;
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size == 0)
+    {
+        close(fd);
+        return false;
+    }
+    void *data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd); // the mapping keeps the file open
+    if (data == MAP_FAILED)
+        return false;
+    image.data = (const char *)data;
+    image.size = info.st_size;
+#else
+    // no mmap here, read it in one go instead
+    std::FILE *file = std::fopen(fileName, "rb");
+    if (file == NULL)
+        return false;
+    std::fseek(file, 0, SEEK_END);
+    long size = std::ftell(file);
+    std::fseek(file, 0, SEEK_SET);
+    char *data = size > 0 ? new char[size] : NULL;
+    if (data == NULL || std::fread(data, 1, size, file) != (size_t)size)
+    {
+        delete[] data;
+        std::fclose(file);
+        return false;
+    }
+    std::fclose(file);
+    image.data = data;
+    image.size = size;
+#endif
+    return true;
+}
+
+inline void image_unmap(MappedImage &image)
+{
+    if (image.data == NULL)
+        return;
+#ifndef _WIN32
+    munmap((void *)image.data, image.size);
+#else
+    delete[] image.data;
+#endif
+    image.data = NULL;
+    image.size = 0;
+}
+
+// Returns the header, or NULL if the image was written by another version
+// or is cut short. Once this succeeds every section lies within the image.
+inline const ImageHeader *image_header(const MappedImage &image, const size_t recordSizes[8])
+{
+    if (image.size < sizeof(ImageHeader))
+        return NULL;
+    const ImageHeader *header = (const ImageHeader *)image.data;
+    if (std::memcmp(header->magic, IMAGE_MAGIC, sizeof(IMAGE_MAGIC)) != 0 ||
+        header->version != IMAGE_VERSION || header->headerSize != sizeof(ImageHeader) ||
+        header->fileSize != image.size)
+        return NULL;
+
+    for (int i = 0; i < 8; i++)
+    {
+        const ImageSection &section = header->sections[i];
+        if (section.count == 0)
+            continue;
+        if (section.offset % 8 != 0 || section.offset > image.size ||
+            section.count > (image.size - section.offset) / recordSizes[i])
+            return NULL;
+    }
+    if (header->strings.offset > image.size ||
+        header->strings.count > image.size - header->strings.offset)
+        return NULL;
+    return header;
+}
+
+template <class T>
+const T *image_section(const MappedImage &image, const ImageHeader *header, int section)
+{
+    return (const T *)(image.data + header->sections[section].offset);
+}
+
+// strings that point outside the heap come back empty
+inline std::string image_string(const MappedImage &image, const ImageHeader *header,
+                                ImageString ref)
+{
+    if (ref.offset > header->strings.count || ref.length > header->strings.count - ref.offset)
+        return std::string();
+    return std::string(image.data + header->strings.offset + ref.offset, ref.length);
+}
+
+#endif
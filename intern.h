@@ -0,0 +1,59 @@
+#ifndef INTERN_H
+#define INTERN_H
+
+#include <deque>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+// Dictionary of repeated strings: each distinct string is stored once and
+// referred to by a small integer ID, so equal strings have equal IDs.
+struct StringPool
+{
+    std::deque<std::string> strings;                // ID -> string, never moved once added
+    std::unordered_map<std::string_view, int> ids; // keys point into strings
+
+    StringPool() {}
+    StringPool(StringPool &&) = default;
+    StringPool &operator=(StringPool &&) = default;
+
+    // a copy needs keys that point into its own strings
+    StringPool(const StringPool &other) : strings(other.strings)
+    {
+        for (int i = 0; i < (int)strings.size(); i++)
+            ids[strings[i]] = i;
+    }
+
+    StringPool &operator=(const StringPool &other)
+    {
+        StringPool copy(other);
+        *this = std::move(copy);
+        return *this;
+    }
+};
+
+// looking up a string that is already in the pool copies nothing
+inline int pool_intern(StringPool &pool, std::string_view str)
+{
+    std::unordered_map<std::string_view, int>::const_iterator it = pool.ids.find(str);
+    if (it != pool.ids.end())
+        return it->second;
+    int ID = (int)pool.strings.size();
+    pool.strings.push_back(std::string(str));
+    pool.ids[pool.strings.back()] = ID;
+    return ID;
+}
+
+// returns -1 if the string was never interned
+inline int pool_find(const StringPool &pool, std::string_view str)
+{
+    std::unordered_map<std::string_view, int>::const_iterator it = pool.ids.find(str);
+    return it == pool.ids.end() ? -1 : it->second;
+}
+
+inline const std::string &pool_get(const StringPool &pool, int ID)
+{
+    return pool.strings[ID];
+}
+
+#endif
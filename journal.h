@@ -0,0 +1,333 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#ifndef _WIN32
+#include <unistd.h>
+#else
+#include <io.h>
+#endif
+
+#include "csv.h"
+
+enum JournalFlush
+{
+    FLUSH_IMMEDIATE,     // every event is written as it is appended
+    FLUSH_EVERY_MS,      // buffered events are written every `every` ms
+    FLUSH_EVERY_RECORDS, // buffered events are written `every` at a time
+};
+
+// When appended events reach the file. Events still buffered are lost if
+// the program crashes; with `sync` each write is also forced to the disk
+// (fsync), otherwise a crash of the whole machine can lose them too.
+struct JournalPolicy
+{
+    JournalFlush flush;
+    int every;
+    bool sync;
+};
+
+// Every event is one CSV row of JOURNAL_FIELDS columns: the name of the
+// event, its fields, then empty columns. Fields are quoted like those of
+// the CSV files, so they may hold commas and quotes.
+const int JOURNAL_FIELDS = 8;
+
+typedef io::double_quote_escape<',', '"'> JournalQuote;
+typedef io::CSVWriter<JOURNAL_FIELDS, io::trim_chars<>, JournalQuote> JournalWriter;
+typedef io::CSVReader<JOURNAL_FIELDS, io::trim_chars<>, JournalQuote> JournalReader;
+
+// Append-only log of the changes made since the CSV files were last
+// rewritten.
+//
+// While the CSV files are being rewritten the events they cover are moved
+// aside to `compactingFileName`, and new events go to a fresh `fileName`.
+// Events that cannot be replayed are copied to `rejectedFileName`, which
+// nothing clears.
+struct Journal
+{
+    std::string fileName;
+    std::string compactingFileName;
+    std::string rejectedFileName;
+    long long size;   // bytes appended to fileName since it was started
+    time_t startTime; // when the oldest event of fileName was written
+
+    JournalPolicy policy;
+    std::FILE *file;     // fileName, opened on the first append
+    std::string pending; // events not written yet
+    int pendingCount;
+    bool writeFailed; // the last write may have left part of a line
+    std::chrono::steady_clock::time_point lastFlush;
+};
+
+inline Journal journal_open(const std::string &fileName, const std::string &compactingFileName,
+                            const std::string &rejectedFileName)
+{
+    Journal journal;
+    journal.fileName = fileName;
+    journal.compactingFileName = compactingFileName;
+    journal.rejectedFileName = rejectedFileName;
+
+    std::ifstream is(fileName.c_str(), std::ios::binary | std::ios::ate);
+    journal.size = is ? (long long)is.tellg() : 0;
+
+    // the events left by an earlier run are at least as old as the last
+    // write to the file
+    struct stat info;
+    if (journal.size > 0 && stat(fileName.c_str(), &info) == 0)
+        journal.startTime = info.st_mtime;
+    else
+        journal.startTime = std::time(NULL);
+
+    JournalPolicy policy = {FLUSH_IMMEDIATE, 0, false};
+    journal.policy = policy;
+    journal.file = NULL;
+    journal.pendingCount = 0;
+    journal.writeFailed = false;
+    journal.lastFlush = std::chrono::steady_clock::now();
+    return journal;
+}
+
+// Writes the buffered events out, and syncs them if the policy says so.
+// If that fails the events stay buffered for the next flush, and false is
+// returned. The events that did reach the file are then written again;
+// replaying an event twice changes nothing.
+inline bool journal_flush(Journal &journal)
+{
+    journal.lastFlush = std::chrono::steady_clock::now();
+    if (journal.pending.empty())
+        return true;
+    if (journal.file == NULL)
+        journal.file = std::fopen(journal.fileName.c_str(), "ab");
+
+    bool written = journal.file != NULL;
+    // ends a line that a failed write may have cut, replay skips empty lines
+    if (written && journal.writeFailed)
+        written = std::fputc('\n', journal.file) != EOF;
+    written = written &&
+              std::fwrite(journal.pending.data(), 1, journal.pending.size(), journal.file) ==
+                  journal.pending.size() &&
+              std::fflush(journal.file) == 0;
+    if (written && journal.policy.sync)
+    {
+#ifndef _WIN32
+        written = fsync(fileno(journal.file)) == 0;
+#else
+        written = _commit(_fileno(journal.file)) == 0;
+#endif
+    }
+    if (!written)
+    {
+        std::cout << "error: could not write " << journal.fileName << " (" << std::strerror(errno)
+                  << "), " << journal.pendingCount << " events are kept in memory\n";
+        if (journal.file != NULL)
+            std::fclose(journal.file); // reopened by the next flush
+        journal.file = NULL;
+        journal.writeFailed = true;
+        return false;
+    }
+    journal.writeFailed = false;
+    journal.pending.clear();
+    journal.pendingCount = 0;
+    return true;
+}
+
+// flushes if the policy's interval has passed, call it now and then
+inline void journal_tick(Journal &journal)
+{
+    if (journal.policy.flush == FLUSH_EVERY_MS &&
+        std::chrono::steady_clock::now() - journal.lastFlush >=
+            std::chrono::milliseconds(journal.policy.every))
+        journal_flush(journal);
+}
+
+// the empty columns after the fields of an event
+template <std::size_t>
+const char *journal_blank()
+{
+    return "";
+}
+
+template <std::size_t... Blanks, class... Fields>
+void journal_writeEvent(JournalWriter &out, std::index_sequence<Blanks...>, const Fields &...fields)
+{
+    out.write_row(fields..., journal_blank<Blanks>()...);
+}
+
+// Appends an event named `type`. Its fields are written as CSVWriter writes
+// them, numbers included, so they read back exactly. Throws
+// io::error::column_not_writable for fields holding a line break.
+template <class... Fields>
+void journal_append(Journal &journal, const char *type, const Fields &...fields)
+{
+    std::ostringstream os;
+    {
+        JournalWriter out(journal.fileName, os);
+        journal_writeEvent(out, std::make_index_sequence<JOURNAL_FIELDS - 1 - sizeof...(Fields)>(),
+                           type, fields...);
+    }
+    std::string event = os.str();
+
+    if (journal.size == 0)
+        journal.startTime = std::time(NULL);
+    journal.pending += event;
+    journal.pendingCount++;
+    journal.size += event.size();
+
+    if (journal.policy.flush == FLUSH_IMMEDIATE ||
+        (journal.policy.flush == FLUSH_EVERY_RECORDS && journal.pendingCount >= journal.policy.every))
+        journal_flush(journal);
+    else
+        journal_tick(journal);
+}
+
+// flushes and closes the file, the next append opens it again; returns
+// false if the flush failed
+inline bool journal_close(Journal &journal)
+{
+    bool flushed = journal_flush(journal);
+    if (journal.file != NULL)
+        std::fclose(journal.file);
+    journal.file = NULL;
+    return flushed;
+}
+
+// Reads the fields of one event. Events written before fields were quoted
+// do not have JOURNAL_FIELDS columns; they are split at every comma, as
+// they were then, and keep their own number of fields.
+inline void journal_parse(const std::string &fileName, const char *line,
+                          std::vector<std::string> &fields)
+{
+    fields.assign(JOURNAL_FIELDS, std::string());
+    try
+    {
+        JournalReader in(fileName, line, line + std::strlen(line));
+        if (in.read_row(fields[0], fields[1], fields[2], fields[3], fields[4], fields[5],
+                        fields[6], fields[7]))
+            return;
+    }
+    catch (io::error::base &)
+    {
+    }
+
+    fields.clear();
+    for (const char *field = line;; line++)
+    {
+        if (*line == ',' || *line == '\0')
+        {
+            fields.push_back(std::string(field, line));
+            if (*line == '\0')
+                break;
+            field = line + 1;
+        }
+    }
+}
+
+// appends lines to the rejected events
+inline void journal_keep(const Journal &journal, const std::string &lines)
+{
+    if (lines.empty())
+        return;
+    std::ofstream os(journal.rejectedFileName.c_str(), std::ios::binary | std::ios::app);
+    os << lines;
+}
+
+// Calls apply(fields) for every event of `fileName`, oldest first. The
+// events apply() returns false for are kept in the rejected file, and so
+// is the whole file if it cannot be read to the end. Returns the number of
+// rejected events.
+template <class Apply>
+int journal_replay(const Journal &journal, const std::string &fileName, Apply apply)
+{
+    FILE *file = std::fopen(fileName.c_str(), "rb");
+    if (file == NULL) // nothing was journaled yet
+        return 0;
+
+    std::string rejected;
+    int rejectedCount = 0;
+    try
+    {
+        io::LineReader in(fileName, file);
+        std::vector<std::string> fields;
+        while (char *line = in.next_line())
+        {
+            if (*line == '\0')
+                continue;
+            journal_parse(fileName, line, fields);
+            if (!apply(fields))
+            {
+                rejected += line;
+                rejected += '\n';
+                rejectedCount++;
+            }
+        }
+    }
+    catch (...)
+    {
+        std::ifstream is(fileName.c_str(), std::ios::binary);
+        std::ostringstream all;
+        all << is.rdbuf();
+        journal_keep(journal, all.str());
+        throw;
+    }
+    journal_keep(journal, rejected);
+    return rejectedCount;
+}
+
+// true while the events of the compacting file are not in the CSV files yet
+inline bool journal_compacting(const Journal &journal)
+{
+    std::FILE *file = std::fopen(journal.compactingFileName.c_str(), "rb");
+    if (file == NULL)
+        return false;
+    std::fclose(file);
+    return true;
+}
+
+// Moves the journaled events to the compacting file and starts a new one.
+// Returns false if the previous compaction has not finished, in which case
+// nothing is moved.
+inline bool journal_rotate(Journal &journal)
+{
+    if (journal_compacting(journal))
+        return false;
+    journal_close(journal);
+    // a missing journal simply means nothing was journaled yet
+    std::rename(journal.fileName.c_str(), journal.compactingFileName.c_str());
+    journal.size = 0;
+    journal.startTime = std::time(NULL);
+    return true;
+}
+
+// drops all events, buffered ones included
+inline void journal_clear(Journal &journal)
+{
+    journal.pending.clear();
+    journal.pendingCount = 0;
+    journal_close(journal);
+    std::ofstream os(journal.fileName.c_str(), std::ios::trunc);
+    os.close();
+    journal.size = 0;
+    journal.startTime = std::time(NULL);
+}
+
+// called once the events of the compacting file are safely in the CSV files
+inline void journal_dropCompacted(const Journal &journal)
+{
+    std::remove(journal.compactingFileName.c_str());
+}
+
+#endif
@@ -1,26 +1,78 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <ctime>
 #include <fstream>
 #include <iostream>
+#include <limits>
+#include <random>
+#include <set>
+#include <sstream>
 #include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
+#include "bookings.h"
+#include "checkpoint.h"
 #include "csv.h"
+#include "image.h"
+#include "intern.h"
+#include "journal.h"
+#include "parallel.h"
 #include "pdfgen.c"
 #include "sha256.cpp"
+#include "slots.h"
+#include "store.h"
 
 using namespace std;
 
+// brand, model and color repeat a lot across the fleet, so they are kept
+// once in Fleet::attributes and the cars only hold their IDs
 struct Car
 {
     string plateNumber;
-    string brand;
-    string model;
+    int brand;
+    int model;
     int year;
-    string color;
+    int color;
     double pricePerDay;
+};
+
+struct Reservation
+{
+    int car; // car handle
+    int clientID;
     time_t startDate;
     time_t endDate;
 };
 
+// Column-wise copy of the car fields that listings filter and aggregate on,
+// indexed by car handle, so those scans read a few dense arrays instead of
+// whole Car records.
+struct FleetColumns
+{
+    vector<double> price;
+    vector<int> year;
+    vector<unsigned char> live; // 0 for the slots of removed cars
+    vector<int> brand;
+    vector<int> model;
+    vector<int> color;
+};
+
+// the cars for rent, indexed by plate number, and their reservations
+struct Fleet
+{
+    Store<Car> cars;
+    unordered_map<string, int> byPlate; // plate number -> car handle
+    Store<Reservation> reservations;
+    vector<vector<Booking> > bookings; // car handle -> its sorted bookings
+    set<pair<double, int> > byPrice;   // (price per day, car handle)
+    FleetColumns columns;
+    StringPool attributes; // brands, models and colors
+};
+
 struct Client
 {
     int ID;
@@ -29,11 +81,27 @@ struct Client
     string password;
     string phone;
     string email;
-    int nbReservation;
-    Car *cars;
+    vector<int> reservations; // reservation handles, removed ones are skipped
     bool admin;
 };
 
+// the registered clients, indexed by ID
+struct ClientBook
+{
+    Store<Client> clients;
+    vector<int> slotById; // client ID -> client handle, -1 for unused IDs
+    unordered_set<string> emails; // normalized, see normalizeContact
+    unordered_set<string> phones;
+};
+
+// emails and phone numbers are compared case-insensitively
+string normalizeContact(string contact)
+{
+    for (int i = 0; i < (int)contact.length(); i++)
+        contact[i] = tolower(contact[i]);
+    return contact;
+}
+
 void TimeToString(char DateText[], int TextSize, time_t t)
 {
     tm *time = localtime(&t);
@@ -88,114 +156,551 @@ time_t inputTime(bool isStartDate)
     return time;
 }
 
-void writeClientToFile(ofstream &os, Client client)
+// How the CSV files are quoted: a column with a ',' or a '"' in it, or with
+// spaces around it, is written between '"'s and reads back the same. Files
+// written before columns were quoted can hold a lone '"', such as 17" rims,
+// so a '"' only opens a quoted column at its start.
+typedef io::trim_chars<' ', '\t'> CsvTrim;
+typedef io::lenient_double_quote_escape<',', '"'> CsvQuote;
+
+typedef io::CSVWriter<7, CsvTrim, CsvQuote> ClientsWriter;
+typedef io::CSVWriter<6, CsvTrim, CsvQuote> CarsWriter;
+typedef io::CSVWriter<4, CsvTrim, CsvQuote> RentalsWriter;
+
+// Runs write, which fills a CSV file through a CSVWriter. A column that
+// cannot be written fails the stream, so the file is not committed, and the
+// error goes to log.
+template <class Write>
+void writeCSV(ofstream &os, ostream &log, Write write)
 {
-    os << "\n";
-    os << client.ID << "," << client.firstName << "," << client.lastName << ","
-       << client.password << "," << client.email << "," << client.phone << ","
-       << (client.admin ? "true" : "false");
+    try
+    {
+        write();
+    }
+    catch (exception &e)
+    {
+        log << "error: " << e.what() << "\n";
+        os.setstate(ios::failbit);
+    }
 }
 
-void writeClientsToFile(Client *clients, int size)
+void writeClientToFile(ClientsWriter &out, const Client &client)
 {
-    ofstream os("clients.csv");
-    os << "ID,fName,lName,Pass,Email,phoneNb,admin";
-    for (int i = 0; i < size; i++)
-        writeClientToFile(os, clients[i]);
-    os.close();
+    out.write_row(client.ID, client.firstName, client.lastName, client.password,
+                  client.email, client.phone, client.admin ? "true" : "false");
 }
 
-void addClientToFile(Client client)
+void writeClientsToFile(ofstream &os, ostream &log, const Store<Client> &clients)
 {
-    ofstream os("clients.csv", ios::app);
-    writeClientToFile(os, client);
-    os.close();
+    writeCSV(os, log, [&]()
+             {
+                 ClientsWriter out("clients.csv", os);
+                 out.write_header("ID", "fName", "lName", "Pass", "Email", "phoneNb", "admin");
+                 for (int i = 0; i < store_end(clients); i++)
+                     if (store_alive(clients, i))
+                         writeClientToFile(out, clients.items[i]);
+             });
 }
 
-void clients_add(Client *&clients, int &size, Client client)
+// Optional copy of the car table in fixed-width slots (see slots.h). While
+// cars.dat exists it takes the place of cars.csv, and every change to a car
+// is written to the car's slot at once instead of at the next checkpoint.
+// `carrental --to-cars-dat` creates it, `carrental --to-csv` removes it.
+struct CarSlot
 {
-    Client *newClients = new Client[size + 1];
-    for (int i = 0; i < size; i++)
-        newClients[i] = clients[i];
-    newClients[size] = client;
+    char plateNumber[16]; // padded with '\0', not terminated when full
+    char brand[32];
+    char model[32];
+    char color[32];
+    int32_t year;
+    int32_t used;
+    double pricePerDay;
+};
+
+struct CarSlots
+{
+    bool enabled;
+    SlotFile file;
+    vector<int> slotOf; // car handle -> slot, -1 if it has none
+};
 
-    if (size != 0)
-        delete[] clients;
+const char *carsSlotFile = "cars.dat";
+CarSlots carSlots = {};
 
-    clients = newClients;
-    size += 1;
+void copyToSlotField(char *field, size_t size, const string &value, const string &plateNumber)
+{
+    if (value.size() > size)
+        cout << "error: \"" << value << "\" of " << plateNumber << " is cut to " << size
+             << " characters in " << carsSlotFile << "\n";
+    memset(field, 0, size);
+    memcpy(field, value.data(), min(size, value.size()));
 }
 
-Client *clients_get(Client *clients, int size, int ID)
+// While cars.dat is used, values longer than their field there are refused:
+// the plate number is the key the cars are found by when it is read back.
+bool fitsCarSlot(const string &value, size_t size)
 {
-    for (int i = 0; i < size; i++)
-        if (clients[i].ID == ID)
-            return &clients[i];
-    return NULL;
+    if (!carSlots.enabled || value.size() <= size)
+        return true;
+    cout << "\"" << value << "\" is longer than the " << size << " characters that fit in "
+         << carsSlotFile << "\n";
+    return false;
 }
 
-void cars_add(Car *&cars, int &size, Car car)
+string slotField(const char *field, size_t size)
 {
-    Car *newCars = new Car[size + 1];
-    for (int i = 0; i < size; i++)
-        newCars[i] = cars[i];
-    newCars[size] = car;
+    return string(field, find(field, field + size, '\0'));
+}
 
-    if (size != 0)
-        delete[] cars;
+// writes the car's slot, or frees it if the car was removed
+void carSlots_store(const Fleet &fleet, int handle)
+{
+    if (!carSlots.enabled)
+        return;
+    if (handle >= (int)carSlots.slotOf.size())
+        carSlots.slotOf.resize(handle + 1, -1);
+    int &slot = carSlots.slotOf[handle];
+
+    CarSlot record = {};
+    const Car *car = store_get(fleet.cars, handle);
+    if (car == NULL)
+    {
+        if (slot != -1)
+            slots_release(carSlots.file, slot, &record);
+        slot = -1;
+        return;
+    }
 
-    cars = newCars;
-    size += 1;
+    copyToSlotField(record.plateNumber, sizeof(record.plateNumber), car->plateNumber, car->plateNumber);
+    copyToSlotField(record.brand, sizeof(record.brand), pool_get(fleet.attributes, car->brand), car->plateNumber);
+    copyToSlotField(record.model, sizeof(record.model), pool_get(fleet.attributes, car->model), car->plateNumber);
+    copyToSlotField(record.color, sizeof(record.color), pool_get(fleet.attributes, car->color), car->plateNumber);
+    record.year = car->year;
+    record.used = 1;
+    record.pricePerDay = car->pricePerDay;
+
+    if (slot == -1)
+        slot = slots_allocate(carSlots.file);
+    if (!slots_write(carSlots.file, slot, &record))
+        cout << "error: could not write " << car->plateNumber << " to " << carsSlotFile << "\n";
 }
 
-Car *cars_get(Car *cars, int size, string plateNumber)
+// Every change is appended to the journal as it happens; the CSV files are
+// only rewritten at checkpoints, see maybeCompact, checkpoint and
+// replayJournal.
+Journal journal = journal_open("journal.log", "journal-compacting.log", "journal-rejected.log");
+
+// cin is tied to this stream, so it is flushed before every read from the
+// user: the prompts on cout show, and with --flush=<N>ms the buffered
+// events are written out instead of waiting while the user is idle.
+struct FlushBeforeInput : streambuf
 {
-    for (int i = 0; i < size; i++)
-        if (cars[i].plateNumber == plateNumber)
-            return &cars[i];
-    return NULL;
+    int sync()
+    {
+        cout.flush();
+        if (journal.policy.flush == FLUSH_EVERY_MS)
+            journal_flush(journal);
+        return 0;
+    }
+};
+
+FlushBeforeInput flushBeforeInput;
+ostream inputTie(&flushBeforeInput);
+
+// the data files, as bits of a set of files
+enum DataFiles
+{
+    CARS_FILE = 1,
+    CLIENTS_FILE = 2,
+    RENTED_CARS_FILE = 4,
+    IMAGE_FILE = 8, // rewritten with any CSV file, see filesToWrite
+    ALL_FILES = 15,
+    JOURNAL_FILE = 16 // only in unloadedFiles, see replayJournal
+};
+
+// the files that no longer match the data in memory
+atomic<unsigned> dirtyFiles(0);
+
+// The CSV files, or the journal, that could not be read to the end. Nothing
+// is written over the data files and the journal is kept until they are
+// fixed.
+unsigned unloadedFiles = 0;
+
+unsigned filesChangedBy(const string &eventType)
+{
+    if (eventType == "RENT" || eventType == "CANCEL" || eventType == "MODIFY_DATES")
+        return RENTED_CARS_FILE;
+    // cars.dat is written as the cars change, see carSlots_store
+    unsigned carsFile = carSlots.enabled ? 0 : CARS_FILE;
+    if (eventType == "CAR_ADD")
+        return carsFile;
+    if (eventType == "CAR_EDIT" || eventType == "CAR_DELETE") // reservations name the car by plate
+        return carsFile | RENTED_CARS_FILE;
+    if (eventType == "CLIENT_ADD")
+        return CLIENTS_FILE;
+    return 0;
 }
 
-Car *cars_get_client(Client *clients, int size, string plateNumber, int &ID)
+template <class... Fields>
+void journalEvent(const char *type, const Fields &...fields)
 {
-    for (int i = 0; i < size; i++)
+    dirtyFiles |= filesChangedBy(type);
+    try
     {
-        Client client = clients[i];
-        for (int j = 0; j < client.nbReservation; j++)
-        {
-            if (client.cars->plateNumber == plateNumber)
-            {
-                ID = client.ID;
-                return client.cars;
-            }
-        }
+        journal_append(journal, type, fields...);
+    }
+    catch (exception &e)
+    {
+        cout << "error: " << e.what() << "\n";
     }
-    return NULL;
 }
 
-void cars_remove(Car *&cars, int &size, string plateNumber)
+void journalRent(const Fleet &fleet, const Reservation &res)
 {
-    if (cars_get(cars, size, plateNumber) == NULL)
-        return;
+    char startDate[20];
+    char endDate[20];
+    TimeToString(startDate, 20, res.startDate);
+    TimeToString(endDate, 20, res.endDate);
+
+    journalEvent("RENT", res.clientID, fleet.cars.items[res.car].plateNumber, startDate, endDate);
+}
+
+// a reservation is identified by its car and start date
+void journalCancel(const Fleet &fleet, const Reservation &res)
+{
+    char startDate[20];
+    TimeToString(startDate, 20, res.startDate);
+
+    journalEvent("CANCEL", fleet.cars.items[res.car].plateNumber, startDate);
+}
+
+void journalModifyDates(const Fleet &fleet, const Reservation &res, time_t oldStartDate)
+{
+    char oldDate[20];
+    char startDate[20];
+    char endDate[20];
+    TimeToString(oldDate, 20, oldStartDate);
+    TimeToString(startDate, 20, res.startDate);
+    TimeToString(endDate, 20, res.endDate);
+
+    journalEvent("MODIFY_DATES", fleet.cars.items[res.car].plateNumber, oldDate, startDate, endDate);
+}
+
+void journalCarAdd(const Fleet &fleet, const Car &car)
+{
+    journalEvent("CAR_ADD", car.plateNumber, pool_get(fleet.attributes, car.brand), car.year,
+                 pool_get(fleet.attributes, car.model), car.pricePerDay,
+                 pool_get(fleet.attributes, car.color));
+}
+
+// records the whole car as it is after the edit
+void journalCarEdit(const Fleet &fleet, const string &oldPlateNumber, const Car &car)
+{
+    journalEvent("CAR_EDIT", oldPlateNumber, car.plateNumber, pool_get(fleet.attributes, car.brand),
+                 car.year, pool_get(fleet.attributes, car.model), car.pricePerDay,
+                 pool_get(fleet.attributes, car.color));
+}
+
+void journalCarDelete(const string &plateNumber)
+{
+    journalEvent("CAR_DELETE", plateNumber);
+}
+
+void journalClientAdd(const Client &client)
+{
+    journalEvent("CLIENT_ADD", client.ID, client.firstName, client.lastName, client.password,
+                 client.email, client.phone, client.admin ? "true" : "false");
+}
+
+// returns -1 if the ID is negative or already taken
+int clients_add(ClientBook &book, Client &&client)
+{
+    int ID = client.ID;
+    if (ID < 0 || (ID < (int)book.slotById.size() && book.slotById[ID] != -1))
+        return -1;
+    if (ID >= (int)book.slotById.size())
+        book.slotById.resize(ID + 1, -1);
+    book.emails.insert(normalizeContact(client.email));
+    book.phones.insert(normalizeContact(client.phone));
+    int handle = store_add(book.clients, std::move(client));
+    book.slotById[ID] = handle;
+    return handle;
+}
+
+Client *clients_get(ClientBook &book, int ID)
+{
+    if (ID < 0 || ID >= (int)book.slotById.size())
+        return NULL;
+    return store_get(book.clients, book.slotById[ID]);
+}
+
+// copies the car's fields into the columns and cars.dat, call it after
+// every change
+void cars_syncColumns(Fleet &fleet, int handle)
+{
+    carSlots_store(fleet, handle);
+
+    FleetColumns &columns = fleet.columns;
+    int size = store_end(fleet.cars);
+    if ((int)columns.live.size() < size)
+    {
+        columns.price.resize(size, 0);
+        columns.year.resize(size, 0);
+        columns.live.resize(size, 0);
+        columns.brand.resize(size, -1);
+        columns.model.resize(size, -1);
+        columns.color.resize(size, -1);
+    }
 
-    if (size == 1)
+    const Car *car = store_get(fleet.cars, handle);
+    if (car == NULL)
     {
-        delete[] cars;
-        size = 0;
-        cars = NULL;
+        columns.live[handle] = 0;
         return;
     }
+    columns.price[handle] = car->pricePerDay;
+    columns.year[handle] = car->year;
+    columns.live[handle] = 1;
+    columns.brand[handle] = car->brand;
+    columns.model[handle] = car->model;
+    columns.color[handle] = car->color;
+}
+
+// returns -1 if a car with the same plate number is already in the fleet, or
+// if the plate number does not fit in cars.dat
+int cars_add(Fleet &fleet, Car &&car)
+{
+    if (fleet.byPlate.count(car.plateNumber) != 0 ||
+        !fitsCarSlot(car.plateNumber, sizeof(CarSlot::plateNumber)))
+        return -1;
+    string plateNumber = car.plateNumber;
+    int handle = store_add(fleet.cars, std::move(car));
+    fleet.byPlate[plateNumber] = handle;
+    fleet.bookings.resize(store_end(fleet.cars));
+    fleet.byPrice.insert(make_pair(fleet.cars.items[handle].pricePerDay, handle));
+    cars_syncColumns(fleet, handle);
+    return handle;
+}
+
+int cars_find(const Fleet &fleet, const string &plateNumber)
+{
+    unordered_map<string, int>::const_iterator it = fleet.byPlate.find(plateNumber);
+    return it == fleet.byPlate.end() ? -1 : it->second;
+}
+
+Car *cars_get(Fleet &fleet, const string &plateNumber)
+{
+    return store_get(fleet.cars, cars_find(fleet, plateNumber));
+}
+
+void rentals_remove(Fleet &fleet, int reservation);
+
+void cars_remove(Fleet &fleet, const string &plateNumber)
+{
+    int handle = cars_find(fleet, plateNumber);
+    if (handle == -1)
+        return;
+    while (!fleet.bookings[handle].empty())
+        rentals_remove(fleet, fleet.bookings[handle].back().reservation);
+    fleet.byPlate.erase(plateNumber);
+    fleet.byPrice.erase(make_pair(fleet.cars.items[handle].pricePerDay, handle));
+    store_remove(fleet.cars, handle);
+    cars_syncColumns(fleet, handle);
+}
+
+// returns false if the new plate number is already taken by another car, or
+// does not fit in cars.dat
+bool cars_rename(Fleet &fleet, int handle, const string &plateNumber)
+{
+    Car *car = store_get(fleet.cars, handle);
+    if (car == NULL)
+        return false;
+    if (car->plateNumber == plateNumber)
+        return true;
+    if (fleet.byPlate.count(plateNumber) != 0 ||
+        !fitsCarSlot(plateNumber, sizeof(CarSlot::plateNumber)))
+        return false;
+    fleet.byPlate.erase(car->plateNumber);
+    fleet.byPlate[plateNumber] = handle;
+    car->plateNumber = plateNumber;
+    return true;
+}
+
+void cars_setPrice(Fleet &fleet, int handle, double pricePerDay)
+{
+    Car *car = store_get(fleet.cars, handle);
+    if (car == NULL)
+        return;
+    fleet.byPrice.erase(make_pair(car->pricePerDay, handle));
+    car->pricePerDay = pricePerDay;
+    fleet.byPrice.insert(make_pair(pricePerDay, handle));
+    cars_syncColumns(fleet, handle);
+}
+
+// bounds are inclusive, -1 attribute IDs match anything
+struct CarFilter
+{
+    double minPrice;
+    double maxPrice;
+    int minYear;
+    int maxYear;
+    int brand;
+    int model;
+    int color;
+};
+
+CarFilter carFilter_all()
+{
+    CarFilter filter = {-numeric_limits<double>::infinity(), numeric_limits<double>::infinity(),
+                        numeric_limits<int>::min(), numeric_limits<int>::max(), -1, -1, -1};
+    return filter;
+}
 
-    Car *newCars = new Car[size - 1];
+// appends the handles of the matching cars to `selection`, in handle order
+void cars_filter(const FleetColumns &columns, const CarFilter &filter, vector<int> &selection)
+{
+    int size = columns.live.size();
+    const double *price = columns.price.data();
+    const int *year = columns.year.data();
+    const unsigned char *live = columns.live.data();
+    const int *brand = columns.brand.data();
+    const int *model = columns.model.data();
+    const int *color = columns.color.data();
+    bool anyBrand = filter.brand == -1, anyModel = filter.model == -1, anyColor = filter.color == -1;
+
+    // branch-free first pass so the compiler can vectorize it
+    vector<unsigned char> keep(size);
+    for (int i = 0; i < size; i++)
+        keep[i] = live[i] & (price[i] >= filter.minPrice) & (price[i] <= filter.maxPrice) &
+                  (year[i] >= filter.minYear) & (year[i] <= filter.maxYear) &
+                  (anyBrand | (brand[i] == filter.brand)) &
+                  (anyModel | (model[i] == filter.model)) &
+                  (anyColor | (color[i] == filter.color));
 
-    int carIndex = 0;
     for (int i = 0; i < size; i++)
-        if (cars[i].plateNumber != plateNumber)
-            newCars[carIndex++] = cars[i];
+        if (keep[i])
+            selection.push_back(i);
+}
+
+struct PriceStats
+{
+    int count;
+    double min;
+    double max;
+    double total;
+};
+
+PriceStats cars_priceStats(const FleetColumns &columns, const vector<int> &selection)
+{
+    PriceStats stats = {0, numeric_limits<double>::infinity(), -numeric_limits<double>::infinity(), 0};
+    const double *price = columns.price.data();
+    for (int i = 0; i < (int)selection.size(); i++)
+    {
+        double p = price[selection[i]];
+        stats.min = p < stats.min ? p : stats.min;
+        stats.max = p > stats.max ? p : stats.max;
+        stats.total += p;
+    }
+    stats.count = selection.size();
+    return stats;
+}
+
+// rented means there is a booking in progress at time t
+bool cars_isRented(const Fleet &fleet, int handle, time_t t)
+{
+    return !bookings_isFree(fleet.bookings[handle], t, t + 1);
+}
+
+bool rentals_isFree(const Fleet &fleet, int car, time_t startDate, time_t endDate, int ignore = -1)
+{
+    return bookings_isFree(fleet.bookings[car], startDate, endDate, ignore);
+}
+
+// returns -1 if the car is already booked in that period
+int rentals_add(Fleet &fleet, Client *client, Reservation &&reservation)
+{
+    int car = reservation.car;
+    if (!rentals_isFree(fleet, car, reservation.startDate, reservation.endDate))
+        return -1;
+    Booking booking = {reservation.startDate, reservation.endDate, -1};
+    int handle = store_add(fleet.reservations, std::move(reservation));
+    booking.reservation = handle;
+    bookings_insert(fleet.bookings[car], booking);
+    client->reservations.push_back(handle);
+    return handle;
+}
+
+// the client keeps the handle, it is skipped from now on
+void rentals_remove(Fleet &fleet, int reservation)
+{
+    Reservation *res = store_get(fleet.reservations, reservation);
+    if (res == NULL)
+        return;
+    bookings_remove(fleet.bookings[res->car], res->startDate, reservation);
+    store_remove(fleet.reservations, reservation);
+}
+
+// the caller checks with rentals_isFree first
+void rentals_move(Fleet &fleet, int reservation, time_t startDate, time_t endDate)
+{
+    Reservation *res = store_get(fleet.reservations, reservation);
+    if (res == NULL)
+        return;
+    vector<Booking> &bookings = fleet.bookings[res->car];
+    bookings_remove(bookings, res->startDate, reservation);
+    res->startDate = startDate;
+    res->endDate = endDate;
+    Booking booking = {startDate, endDate, reservation};
+    bookings_insert(bookings, booking);
+}
+
+// returns the handle of the car's booking in progress at time t, or else of
+// its next one, or -1
+int rentals_current(const Fleet &fleet, int car, time_t t)
+{
+    const vector<Booking> &bookings = fleet.bookings[car];
+    int i = bookings_current(bookings, t);
+    return i == -1 ? -1 : bookings[i].reservation;
+}
+
+// Lists the cars free during [startDate, endDate) whose price per day is at
+// most maxPrice, cheapest first, at most limit of them. The page starts
+// after the (price per day, handle) key `after` of the last car of the
+// previous page, or at the cheapest car if it is NULL; the scan seeks there
+// in the price index and stops as soon as the page is full, so a page costs
+// the same however deep it is. Returns true if there are more matches after
+// the page.
+bool cars_search(const Fleet &fleet, time_t startDate, time_t endDate, double maxPrice,
+                 const pair<double, int> *after, int limit, vector<int> &page)
+{
+    page.clear();
+    set<pair<double, int> >::const_iterator it =
+        after == NULL ? fleet.byPrice.begin() : fleet.byPrice.upper_bound(*after);
+    for (; it != fleet.byPrice.end() && it->first <= maxPrice; ++it)
+    {
+        if (!rentals_isFree(fleet, it->second, startDate, endDate))
+            continue;
+        if ((int)page.size() == limit)
+            return true;
+        page.push_back(it->second);
+    }
+    return false;
+}
 
-    delete[] cars;
-    cars = newCars;
-    size--;
+// returns the handles of the client's reservations of the car
+vector<int> rentals_find(const Fleet &fleet, const Client *client, const string &plateNumber)
+{
+    vector<int> found;
+    int car = cars_find(fleet, plateNumber);
+    if (car == -1)
+        return found;
+    for (int i = 0; i < (int)client->reservations.size(); i++)
+    {
+        const Reservation *res = store_get(fleet.reservations, client->reservations[i]);
+        if (res != NULL && res->car == car)
+            found.push_back(client->reservations[i]);
+    }
+    return found;
 }
 
 bool validatePassword(string pass)
@@ -272,30 +777,22 @@ bool validatePhoneNumber(string number)
     return true;
 }
 
-int client_getNewID(Client *clients, int size)
+int client_getNewID(const ClientBook &book)
 {
-    if (size == 0)
-        return 0;
-    return clients[size - 1].ID + 1;
+    return (int)book.slotById.size();
 }
 
-bool emailAlreadyExists(Client *clients, int clientsCount, string email)
+bool emailAlreadyExists(const ClientBook &book, const string &email)
 {
-    for (int i = 0; i < clientsCount; i++)
-        if (clients[i].email == email)
-            return true;
-    return false;
+    return book.emails.count(normalizeContact(email)) != 0;
 }
 
-bool phoneNumberAlreadyExists(Client *clients, int clientsCount, string ph)
+bool phoneNumberAlreadyExists(const ClientBook &book, const string &ph)
 {
-    for (int i = 0; i < clientsCount; i++)
-        if (clients[i].phone == ph)
-            return true;
-    return false;
+    return book.phones.count(normalizeContact(ph)) != 0;
 }
 
-Client inputClient(Client *clients, int clientsCount)
+Client inputClient(const ClientBook &book)
 {
     Client client = {};
 
@@ -317,7 +814,7 @@ Client inputClient(Client *clients, int clientsCount)
             continue;
         }
 
-        if (emailAlreadyExists(clients, clientsCount, client.email))
+        if (emailAlreadyExists(book, client.email))
         {
             cout << "account with such email already exists, please try "
                     "another one\n";
@@ -351,7 +848,7 @@ Client inputClient(Client *clients, int clientsCount)
             continue;
         }
 
-        if (phoneNumberAlreadyExists(clients, clientsCount, client.phone))
+        if (phoneNumberAlreadyExists(book, client.phone))
         {
             cout << "account with such phone number already exists, please try "
                     "another one\n";
@@ -364,34 +861,42 @@ Client inputClient(Client *clients, int clientsCount)
     return client;
 }
 
-Car inputCar()
+// reads a line, asking again while it does not fit its field of cars.dat
+string inputCarText(const char *prompt, size_t size)
 {
-    Car car = {};
+    string text;
+    do
+    {
+        cout << prompt;
+        getline(cin, text);
+    } while (!fitsCarSlot(text, size));
+    return text;
+}
 
-    car.startDate = -1;
-    car.endDate = -1;
+Car inputCar(Fleet &fleet)
+{
+    Car car = {};
 
-    cout << "Enter the plate number of the car: ";
-    getline(cin, car.plateNumber);
+    car.plateNumber = inputCarText("Enter the plate number of the car: ", sizeof(CarSlot::plateNumber));
 
-    cout << "Enter the brand of the car: ";
-    getline(cin, car.brand);
+    car.brand = pool_intern(fleet.attributes,
+                            inputCarText("Enter the brand of the car: ", sizeof(CarSlot::brand)));
 
     cout << "Enter the year of production: ";
     cin >> car.year;
 
     cin.ignore();
 
-    cout << "Enter the model of the car: ";
-    getline(cin, car.model);
+    car.model = pool_intern(fleet.attributes,
+                            inputCarText("Enter the model of the car: ", sizeof(CarSlot::model)));
 
     cout << "Enter the daily price for rent: ";
     cin >> car.pricePerDay;
 
     cin.ignore();
 
-    cout << "Enter the color of the car: ";
-    getline(cin, car.color);
+    car.color = pool_intern(fleet.attributes,
+                            inputCarText("Enter the color of the car: ", sizeof(CarSlot::color)));
 
     return car;
 }
@@ -404,6 +909,8 @@ enum
     RENT_CAR,
     CANCEL_RENT,
     MODIFY_DATE,
+    SEARCH_CARS,
+    FILTER_CARS,
     // admin actions
     ADD_CAR,
     DELETE_CAR,
@@ -422,63 +929,208 @@ enum
     RETURN_TO_MENU
 };
 
-void printCars(Car *cars, int carsCount)
+void printCars(const Fleet &fleet, const vector<int> &selection)
 {
-    cout << "Cars: (count: " << carsCount << "):\n";
-    for (int i = 0; i < carsCount; i++)
+    time_t now = time(NULL);
+    cout << "Cars: (count: " << selection.size() << "):\n";
+    for (int i = 0; i < (int)selection.size(); i++)
     {
-        Car car = cars[i];
-        cout << "plate number: " << car.plateNumber << ", brand: " << car.brand
-             << ", model: " << car.model << ", year: " << car.year
-             << ", color: " << car.color
+        const Car &car = fleet.cars.items[selection[i]];
+        cout << "plate number: " << car.plateNumber
+             << ", brand: " << pool_get(fleet.attributes, car.brand)
+             << ", model: " << pool_get(fleet.attributes, car.model) << ", year: " << car.year
+             << ", color: " << pool_get(fleet.attributes, car.color)
              << ", price per day: " << car.pricePerDay
-             << (car.startDate == -1 ? " (available)" : " (rented)") << "\n";
+             << (cars_isRented(fleet, selection[i], now) ? " (rented)" : " (available)") << "\n";
     }
+
+    if (!selection.empty())
+    {
+        PriceStats stats = cars_priceStats(fleet.columns, selection);
+        cout << "price per day: from " << stats.min << " to " << stats.max
+             << ", average " << stats.total / stats.count << "\n";
+    }
+}
+
+void printCars(const Fleet &fleet)
+{
+    vector<int> selection;
+    cars_filter(fleet.columns, carFilter_all(), selection);
+    printCars(fleet, selection);
+}
+
+// an empty answer matches any value; a value nobody has matches no car
+int inputAttributeFilter(const Fleet &fleet, const char *name)
+{
+    string value;
+    cout << "Enter the " << name << " (leave empty for any): ";
+    getline(cin, value);
+    if (value.empty())
+        return -1;
+    int ID = pool_find(fleet.attributes, value);
+    return ID == -1 ? (int)fleet.attributes.strings.size() : ID;
+}
+
+void filterCars(const Fleet &fleet)
+{
+    CarFilter filter = carFilter_all();
+
+    cout << "Enter the price per day range (min max): ";
+    cin >> filter.minPrice >> filter.maxPrice;
+    cout << "Enter the year range (min max): ";
+    cin >> filter.minYear >> filter.maxYear;
+    cin.ignore();
+
+    filter.brand = inputAttributeFilter(fleet, "brand");
+    filter.model = inputAttributeFilter(fleet, "model");
+    filter.color = inputAttributeFilter(fleet, "color");
+
+    vector<int> selection;
+    cars_filter(fleet.columns, filter, selection);
+    printCars(fleet, selection);
 }
 
-void printRentedCars(Car *cars, int carsCount)
+void printRentedCars(const Fleet &fleet, const Client *client)
 {
-    cout << "Rented Cars: (count: " << carsCount << "):\n";
-    for (int i = 0; i < carsCount; i++)
+    int count = 0;
+    for (int i = 0; i < (int)client->reservations.size(); i++)
+        if (store_alive(fleet.reservations, client->reservations[i]))
+            count++;
+
+    cout << "Rented Cars: (count: " << count << "):\n";
+    for (int i = 0; i < (int)client->reservations.size(); i++)
     {
-        Car car = cars[i];
-        cout << "plate number: " << car.plateNumber << ", brand: " << car.brand
-             << ", model: " << car.model << ", year: " << car.year
-             << ", color: " << car.color
-             << ", price per day: " << car.pricePerDay << "\n";
+        const Reservation *res = store_get(fleet.reservations, client->reservations[i]);
+        if (res == NULL)
+            continue;
+        const Car &car = fleet.cars.items[res->car];
+        char startDate[20];
+        char endDate[20];
+        TimeToString(startDate, 20, res->startDate);
+        TimeToString(endDate, 20, res->endDate);
+        cout << "plate number: " << car.plateNumber
+             << ", brand: " << pool_get(fleet.attributes, car.brand)
+             << ", model: " << pool_get(fleet.attributes, car.model) << ", year: " << car.year
+             << ", color: " << pool_get(fleet.attributes, car.color)
+             << ", price per day: " << car.pricePerDay
+             << ", from " << startDate << " till " << endDate << "\n";
     }
 }
 
-void modifyDate(Car *car)
+// picks one of the client's reservations of a car, asking for its start date
+// if there are several; returns -1 if the client has none
+int chooseReservation(const Fleet &fleet, const Client *client, const string &plateNumber)
 {
-    time_t startDate = 0;
-    time_t endDate = 0;
+    vector<int> found = rentals_find(fleet, client, plateNumber);
+    if (found.size() <= 1)
+        return found.empty() ? -1 : found[0];
+
+    do
+    {
+        cout << "You have " << found.size() << " reservations of this car.\n";
+        time_t startDate = inputTime(true);
+        for (int i = 0; i < (int)found.size(); i++)
+            if (fleet.reservations.items[found[i]].startDate == startDate)
+                return found[i];
+        cout << "none of them starts on that date\n";
+    } while (true);
+}
 
+// asks for a rental period that does not overlap the other bookings of the
+// car; `self` is the reservation being changed, -1 for a new one
+void inputRentalDates(const Fleet &fleet, int car, int self, time_t &startDate, time_t &endDate)
+{
     time_t today = TimeOfTodayStart();
 
     do
     {
-        if ((startDate = inputTime(true)) < today)
-            cout << "start date should be greater than current date\n";
-        else
+        do
+        {
+            if ((startDate = inputTime(true)) < today)
+                cout << "start date should be greater than current date\n";
+            else
+                break;
+        } while (true);
+
+        do
+        {
+            if ((endDate = inputTime(false)) <= startDate)
+                cout << "end date should be greater than the start date\n";
+            else
+                break;
+        } while (true);
+
+        if (rentals_isFree(fleet, car, startDate, endDate, self))
             break;
+
+        char date[20];
+        TimeToString(date, 20, bookings_nextFree(fleet.bookings[car], startDate, endDate - startDate, self));
+        cout << "the car is already booked in that period, the next free period "
+                "as long starts on " << date << "\n";
     } while (true);
+}
 
-    do
+void modifyDate(Fleet &fleet, int reservation)
+{
+    time_t startDate = 0;
+    time_t endDate = 0;
+    time_t oldStartDate = fleet.reservations.items[reservation].startDate;
+
+    inputRentalDates(fleet, fleet.reservations.items[reservation].car, reservation, startDate, endDate);
+    rentals_move(fleet, reservation, startDate, endDate);
+    journalModifyDates(fleet, fleet.reservations.items[reservation], oldStartDate);
+}
+
+void searchCars(const Fleet &fleet)
+{
+    const int pageSize = 10;
+
+    time_t startDate = inputTime(true);
+    time_t endDate = inputTime(false);
+
+    double maxPrice;
+    cout << "Enter the maximum price per day: ";
+    cin >> maxPrice;
+
+    vector<int> page;
+    pair<double, int> last;
+    for (int offset = 0;; offset += pageSize)
     {
-        if ((endDate = inputTime(false)) <= startDate)
-            cout << "end date should be greater than the start date\n";
-        else
+        bool hasMore = cars_search(fleet, startDate, endDate, maxPrice, offset == 0 ? NULL : &last,
+                                   pageSize, page);
+        if (offset == 0 && page.empty())
+            cout << "No car is free in that period under that price.\n";
+
+        for (int i = 0; i < (int)page.size(); i++)
+        {
+            const Car &car = fleet.cars.items[page[i]];
+            cout << offset + i + 1 << ". plate number: " << car.plateNumber
+                 << ", brand: " << pool_get(fleet.attributes, car.brand)
+                 << ", model: " << pool_get(fleet.attributes, car.model)
+                 << ", year: " << car.year
+                 << ", color: " << pool_get(fleet.attributes, car.color)
+                 << ", price per day: " << car.pricePerDay << "\n";
+        }
+
+        if (!hasMore)
             break;
-    } while (true);
+        last = make_pair(fleet.cars.items[page.back()].pricePerDay, page.back());
 
-    car->startDate = startDate;
-    car->endDate = endDate;
+        string more;
+        cout << "Show more? (y/n): ";
+        cin >> more;
+        if (more != "y")
+            break;
+    }
 }
 
-bool modifyCar(Car *car, Car *car1)
+bool modifyCar(Fleet &fleet, int handle)
 {
     int choice;
+    string plateNumber;
+    string attribute;
+    Car *car = store_get(fleet.cars, handle);
+    string oldPlateNumber = car->plateNumber;
 
     bool hasChange = false;
 
@@ -497,62 +1149,82 @@ bool modifyCar(Car *car, Car *car1)
         cout << "> ";
         cin >> choice;
 
+        bool edited = false;
         switch (choice)
         {
         case CHANGE_PLATENUM:
             cout << "Enter the new plate number: ";
             cin.ignore();
-            cin >> car->plateNumber;
-            car1->plateNumber = car->plateNumber;
-            hasChange = true;
+            cin >> plateNumber;
+            if (!fitsCarSlot(plateNumber, sizeof(CarSlot::plateNumber)))
+                break;
+            if (!cars_rename(fleet, handle, plateNumber))
+            {
+                cout << "A car with such plate number already exists.\n";
+                break;
+            }
+            edited = true;
             break;
 
         case CHANGE_MODEL:
             cout << "Enter the new model: ";
             cin.ignore();
-            cin >> car->model;
-            car1->model = car->model;
-            hasChange = true;
+            cin >> attribute;
+            if (!fitsCarSlot(attribute, sizeof(CarSlot::model)))
+                break;
+            car->model = pool_intern(fleet.attributes, attribute);
+            edited = true;
             break;
 
         case CHANGE_YEAR:
             cout << "Enter the new year: ";
             cin >> car->year;
-            car1->year = car->year;
-            hasChange = true;
+            edited = true;
             break;
 
         case CHANGE_BRAND:
             cout << "Enter the new brand: ";
             cin.ignore();
-            cin >> car->brand;
-            car1->brand = car->brand;
-            hasChange = true;
+            cin >> attribute;
+            if (!fitsCarSlot(attribute, sizeof(CarSlot::brand)))
+                break;
+            car->brand = pool_intern(fleet.attributes, attribute);
+            edited = true;
             break;
 
         case CHANGE_COLOR:
             cout << "Enter the new color: ";
             cin.ignore();
-            cin >> car->color;
-            car1->color = car->color;
-            hasChange = true;
+            cin >> attribute;
+            if (!fitsCarSlot(attribute, sizeof(CarSlot::color)))
+                break;
+            car->color = pool_intern(fleet.attributes, attribute);
+            edited = true;
             break;
 
         case CHANGE_PRICEDAY:
+        {
+            double pricePerDay;
             cout << "Enter the new price per day: ";
-            cin >> car->pricePerDay;
-            car1->pricePerDay = car->pricePerDay;
-            hasChange = true;
-            break;
+            cin >> pricePerDay;
+            cars_setPrice(fleet, handle, pricePerDay);
+            edited = true;
+        }
+        break;
 
         case CHANGE_DATE:
+        {
+            int reservation = rentals_current(fleet, handle, TimeOfTodayStart());
+            if (reservation == -1)
+            {
+                cout << "The car is not rented.\n";
+                break;
+            }
             cout << "Enter the new date: ";
             cin.ignore();
-            modifyDate(car);
-            car1->startDate = car->startDate;
-            car1->endDate = car->endDate;
-            hasChange = true;
-            break;
+            modifyDate(fleet, reservation); // journals the change itself
+        }
+        break;
 
         case RETURN_TO_MENU:
             return hasChange;
@@ -560,256 +1232,1610 @@ bool modifyCar(Car *car, Car *car1)
         default:
             cout << "invalid choice!\n";
         }
+
+        cars_syncColumns(fleet, handle);
+        // journaled one edit at a time, so that a date change made in
+        // between is replayed after the car got its new plate number
+        if (edited)
+        {
+            journalCarEdit(fleet, oldPlateNumber, *car);
+            oldPlateNumber = car->plateNumber;
+            hasChange = true;
+        }
     }
     return hasChange;
 }
 
-void addCarToFile(Car car);
-
-void addCar(Car *&cars, int &carsCount)
+void addCar(Fleet &fleet)
 {
-    Car car = inputCar();
-    cars_add(cars, carsCount, car);
-    addCarToFile(car);
+    Car car = inputCar(fleet);
+    if (cars_find(fleet, car.plateNumber) != -1)
+    {
+        cout << "A car with such plate number already exists.\n";
+        return;
+    }
+    journalCarAdd(fleet, car);
+    cars_add(fleet, std::move(car));
     cout << "added a new car to the available cars for rent.\n";
 }
 
-void loadCarsCSV(Car *&cars, int &size)
+// a row of cars.csv before its attributes are interned; the attributes
+// point into the file, which the reader keeps until the row is added
+struct CarRow
+{
+    Car car;
+    string_view brand, model, color;
+};
+
+typedef io::ParallelCSVReader<6, CsvTrim, CsvQuote> CarsReader;
+
+// parses the rows of a chunk of cars.csv, on a worker thread
+void readCarRows(CarsReader::ChunkReader &chunk, vector<CarRow> &rows)
+{
+    CarRow row = {};
+    while (chunk.read_row(row.car.plateNumber, row.brand, row.car.year, row.model, row.car.pricePerDay, row.color))
+    {
+        rows.push_back(std::move(row));
+        row = {};
+    }
+}
+
+// The rows are parsed in chunks on several threads; interning and adding the
+// cars stays on this thread, in file order.
+// returns false if cars.csv could not be read to the end
+bool loadCarsCSV(Fleet &fleet)
 {
     try
     {
-        io::CSVReader<6> in("cars.csv");
+        CarsReader in("cars.csv");
         in.read_header(io::ignore_extra_column, "plateNum", "Brand", "Year", "Model", "price_Day", "Color");
-        Car car = {};
-        while (in.read_row(car.plateNumber, car.brand, car.year, car.model, car.pricePerDay, car.color))
-        {
-            car.startDate = -1;
-            car.endDate = -1;
-            cars_add(cars, size, car);
-            car = {};
-        }
+        in.read_batches<CarRow>(readCarRows,
+                                [&](vector<CarRow> &rows)
+                                {
+                                    for (int i = 0; i < (int)rows.size(); i++)
+                                    {
+                                        Car &car = rows[i].car;
+                                        car.brand = pool_intern(fleet.attributes, rows[i].brand);
+                                        car.model = pool_intern(fleet.attributes, rows[i].model);
+                                        car.color = pool_intern(fleet.attributes, rows[i].color);
+                                        if (cars_add(fleet, std::move(car)) == -1)
+                                            cout << "error: duplicated plate number in cars.csv\n";
+                                    }
+                                });
     }
-    catch (exception &e)
+    catch (io::error::can_not_open_file &e)
     {
         // cars.csv does not exists
         cout << "error: " << e.what() << "\n";
     }
+    catch (io::error::header_missing &)
+    {
+        // cars.csv is empty, there are no cars yet
+    }
+    catch (exception &e)
+    {
+        cout << "error: " << e.what() << "\n";
+        return false;
+    }
+    return true;
 }
 
-void loadClientsCSV(Client *&clients, int &size)
+// Loads the cars from cars.dat and from then on keeps it up to date.
+// Returns false if cars.dat could not be opened or read to the end; the
+// cars are then not taken from cars.csv, which is older.
+bool loadCarSlots(Fleet &fleet)
 {
-    try
+    if (!slots_open(carSlots.file, carsSlotFile, sizeof(CarSlot)))
     {
-        io::CSVReader<7> in("clients.csv");
-        in.read_header(io::ignore_extra_column, "ID", "fName", "lName", "Pass", "Email", "phoneNb", "admin");
-        Client client = {};
-        string admin = "";
-        while (in.read_row(client.ID, client.firstName, client.lastName, client.password, client.email, client.phone, admin))
+        cout << "error: could not open " << carsSlotFile << ", or it is not a file of car slots\n";
+        return false;
+    }
+
+    bool read = slots_readAll(carSlots.file, [&](int slot, const char *data)
+                              {
+                                  CarSlot record;
+                                  memcpy(&record, data, sizeof(record));
+                                  int handle = -1;
+                                  if (record.used)
+                                  {
+                                      Car car = {};
+                                      car.plateNumber = slotField(record.plateNumber, sizeof(record.plateNumber));
+                                      car.brand = pool_intern(fleet.attributes, slotField(record.brand, sizeof(record.brand)));
+                                      car.model = pool_intern(fleet.attributes, slotField(record.model, sizeof(record.model)));
+                                      car.color = pool_intern(fleet.attributes, slotField(record.color, sizeof(record.color)));
+                                      car.year = record.year;
+                                      car.pricePerDay = record.pricePerDay;
+                                      string plateNumber = car.plateNumber;
+                                      handle = cars_add(fleet, std::move(car));
+                                      // the slot is freed, so the car is dropped as from cars.csv
+                                      if (handle == -1)
+                                          cout << "error: duplicated plate number " << plateNumber << " in "
+                                               << carsSlotFile << "\n";
+                                  }
+                                  if (handle == -1)
+                                  {
+                                      carSlots.file.freeSlots.push_back(slot);
+                                      return;
+                                  }
+                                  if (handle >= (int)carSlots.slotOf.size())
+                                      carSlots.slotOf.resize(handle + 1, -1);
+                                  carSlots.slotOf[handle] = slot;
+                              });
+    if (!read)
+    {
+        cout << "error: could not read " << carsSlotFile << "\n";
+        slots_close(carSlots.file);
+        return false;
+    }
+    carSlots.enabled = true;
+    return true;
+}
+
+// replaces cars.dat with the cars in memory, see CarSlots
+bool createCarSlots(const Fleet &fleet)
+{
+    for (int i = 0; i < store_end(fleet.cars); i++)
+    {
+        const Car *car = store_get(fleet.cars, i);
+        if (car != NULL && car->plateNumber.size() > sizeof(CarSlot::plateNumber))
         {
-            for (int i = 0; i < admin.length(); i++)
-                admin[i] = tolower(admin[i]);
-            client.admin = admin == "true"; // returns true if admin = true else returns false
-            clients_add(clients, size, client);
-            client = {};
-            admin = "";
+            cout << "error: the plate number " << car->plateNumber << " does not fit in "
+                 << carsSlotFile << "\n";
+            return false;
         }
     }
-    catch (exception &e)
+    if (!slots_create(carSlots.file, carsSlotFile, sizeof(CarSlot)))
+        return false;
+    carSlots.enabled = true;
+    carSlots.slotOf.clear();
+    for (int i = 0; i < store_end(fleet.cars); i++)
+        carSlots_store(fleet, i);
+    return slots_sync(carSlots.file);
+}
+
+// returns false if clients.csv could not be read to the end
+bool loadClientsCSV(ClientBook &book)
+{
+    try
+    {
+        io::ParallelCSVReader<7, CsvTrim, CsvQuote> in("clients.csv");
+        in.read_header(io::ignore_extra_column, "ID", "fName", "lName", "Pass", "Email", "phoneNb", "admin");
+        in.read_batches<Client>([](io::ParallelCSVReader<7, CsvTrim, CsvQuote>::ChunkReader &chunk, vector<Client> &rows)
+                                {
+                                    Client client = {};
+                                    string admin = "";
+                                    while (chunk.read_row(client.ID, client.firstName, client.lastName, client.password, client.email, client.phone, admin))
+                                    {
+                                        for (int i = 0; i < (int)admin.length(); i++)
+                                            admin[i] = tolower(admin[i]);
+                                        client.admin = admin == "true"; // returns true if admin = true else returns false
+                                        rows.push_back(std::move(client));
+                                        client = {};
+                                        admin = "";
+                                    }
+                                },
+                                [&](vector<Client> &rows)
+                                {
+                                    for (int i = 0; i < (int)rows.size(); i++)
+                                        if (clients_add(book, std::move(rows[i])) == -1)
+                                            cout << "error: invalid or duplicated ID in clients.csv\n";
+                                });
+    }
+    catch (io::error::can_not_open_file &e)
     {
         // clients.csv does not exists
         cout << "error: " << e.what() << "\n";
     }
+    catch (io::error::header_missing &)
+    {
+        // clients.csv is empty, there are no clients yet
+    }
+    catch (exception &e)
+    {
+        cout << "error: " << e.what() << "\n";
+        return false;
+    }
+    return true;
 }
 
-void loadRentedCarsCSV(Client *clients, int clientsSize, Car *cars, int carsSize)
+struct RentedCarRow
 {
+    int clientID;
+    string plateNumber;
+    string startDate;
+    string endDate;
+};
+
+// Joins rented-cars.csv with the cars and clients, so load those first.
+// Looking up the car and client of every row only reads the indexes and can
+// run in parallel; the reservations are then added in file order. Returns
+// false if rented-cars.csv could not be read to the end.
+bool loadRentedCarsCSV(ClientBook &book, Fleet &fleet)
+{
+    vector<RentedCarRow> rows;
+    bool loaded = true;
     try
     {
-        io::CSVReader<4> in("rented-cars.csv");
+        io::CSVReader<4, CsvTrim, CsvQuote> in("rented-cars.csv");
         // ID,plateNumber,startDate,endDate
         in.read_header(io::ignore_extra_column, "ID", "plateNumber", "startDate", "endDate");
-        int id;
-        string plateNum, startDate, endDate;
-        while (in.read_row(id, plateNum, startDate, endDate))
-        {
-            Client *client = clients_get(clients, clientsSize, id);
-            if (client != NULL)
-            {
-                Car *car = cars_get(cars, carsSize, plateNum);
-                if (car != NULL)
-                {
-                    car->startDate = StringToTime(startDate.c_str());
-                    car->endDate = StringToTime(endDate.c_str());
-                    cars_add(client->cars, client->nbReservation, *car);
-                }
-            }
-        }
+        RentedCarRow row;
+        while (in.read_row(row.clientID, row.plateNumber, row.startDate, row.endDate))
+            rows.push_back(row);
+    }
+    catch (io::error::can_not_open_file &e)
+    {
+        // rented-cars.csv does not exists
+        cout << "error: " << e.what() << "\n";
+    }
+    catch (io::error::header_missing &)
+    {
+        // rented-cars.csv is empty, there are no reservations yet
     }
     catch (exception &e)
     {
-        // cars.csv does not exists
         cout << "error: " << e.what() << "\n";
+        loaded = false;
     }
-}
 
-void rentCar(Car *cars, int carsCount, Client *client);
+    vector<Reservation> found(rows.size());
+    parallel_for(rows.size(), 4096, [&](int begin, int end)
+                 {
+                     for (int i = begin; i < end; i++)
+                     {
+                         Client *client = clients_get(book, rows[i].clientID);
+                         found[i].car = client == NULL ? -1 : cars_find(fleet, rows[i].plateNumber);
+                         if (found[i].car == -1)
+                             continue;
+                         found[i].clientID = client->ID;
+                         found[i].startDate = StringToTime(rows[i].startDate.c_str());
+                         found[i].endDate = StringToTime(rows[i].endDate.c_str());
+                     } });
+
+    for (int i = 0; i < (int)found.size(); i++)
+    {
+        if (found[i].car == -1)
+            continue;
+        Client *client = clients_get(book, found[i].clientID);
+        if (rentals_add(fleet, client, std::move(found[i])) == -1)
+            cout << "error: overlapping reservation of " << rows[i].plateNumber
+                 << " in rented-cars.csv\n";
+    }
+    return loaded;
+}
 
-bool cancelRent(Client *client, Car *cars, int size);
+// returns the handle of the car's reservation starting at startDate, or -1
+int rentals_findByStart(const Fleet &fleet, int car, time_t startDate)
+{
+    const vector<Booking> &bookings = fleet.bookings[car];
+    for (int i = bookings_firstEndingAfter(bookings, startDate);
+         i < (int)bookings.size() && bookings[i].startDate <= startDate; i++)
+        if (bookings[i].startDate == startDate)
+            return bookings[i].reservation;
+    return -1;
+}
 
-bool deleteCar(Car *&cars, int &carsCount);
+Car carFromFields(Fleet &fleet, const vector<string> &fields, int first)
+{
+    Car car = {};
+    car.plateNumber = fields[first];
+    car.brand = pool_intern(fleet.attributes, fields[first + 1]);
+    car.year = atoi(fields[first + 2].c_str());
+    car.model = pool_intern(fleet.attributes, fields[first + 3]);
+    car.pricePerDay = atof(fields[first + 4].c_str());
+    car.color = pool_intern(fleet.attributes, fields[first + 5]);
+    return car;
+}
 
-void writeCarRentInfo(ofstream &os, int id, Car car)
+// the number of fields of an event, its name included, 0 if it is unknown
+int eventFieldCount(const string &type)
 {
-    os << "\n"
-       << id << "," << car.plateNumber << ",";
-    char date[20];
-    TimeToString(date, 20, car.startDate);
-    os << date << ",";
-    TimeToString(date, 20, car.endDate);
-    os << date;
+    if (type == "RENT" || type == "MODIFY_DATES")
+        return 5;
+    if (type == "CANCEL")
+        return 3;
+    if (type == "CAR_ADD")
+        return 7;
+    if (type == "CAR_EDIT" || type == "CLIENT_ADD")
+        return 8;
+    if (type == "CAR_DELETE")
+        return 2;
+    return 0;
 }
 
-void addRentCar(int id, Car car)
+// Applies one journaled event. Events that no longer fit (a car that is
+// already gone, a reservation that already exists...) are skipped, so
+// replaying events that a checkpoint already holds changes nothing.
+// Returns false for events that are not well formed.
+bool applyEvent(ClientBook &book, Fleet &fleet, const vector<string> &fields)
 {
-    ofstream os("rented-cars.csv", ios::app);
-    writeCarRentInfo(os, id, car);
-    os.close();
+    const string &type = fields[0];
+    int count = eventFieldCount(type);
+    // events are padded to JOURNAL_FIELDS, older ones have their own size
+    if (count == 0 || ((int)fields.size() != count && (int)fields.size() != JOURNAL_FIELDS))
+        return false;
+    for (int i = count; i < (int)fields.size(); i++)
+        if (!fields[i].empty())
+            return false;
+    dirtyFiles |= filesChangedBy(type);
+
+    if (type == "RENT")
+    {
+        Client *client = clients_get(book, atoi(fields[1].c_str()));
+        int car = cars_find(fleet, fields[2]);
+        if (client == NULL || car == -1)
+            return true;
+        Reservation res = {};
+        res.car = car;
+        res.clientID = client->ID;
+        res.startDate = StringToTime(fields[3].c_str());
+        res.endDate = StringToTime(fields[4].c_str());
+        rentals_add(fleet, client, std::move(res));
+    }
+    else if (type == "CANCEL")
+    {
+        int car = cars_find(fleet, fields[1]);
+        if (car != -1)
+            rentals_remove(fleet, rentals_findByStart(fleet, car, StringToTime(fields[2].c_str())));
+    }
+    else if (type == "MODIFY_DATES")
+    {
+        int car = cars_find(fleet, fields[1]);
+        if (car == -1)
+            return true;
+        int reservation = rentals_findByStart(fleet, car, StringToTime(fields[2].c_str()));
+        time_t startDate = StringToTime(fields[3].c_str());
+        time_t endDate = StringToTime(fields[4].c_str());
+        if (reservation != -1 && rentals_isFree(fleet, car, startDate, endDate, reservation))
+            rentals_move(fleet, reservation, startDate, endDate);
+    }
+    else if (type == "CAR_ADD")
+    {
+        cars_add(fleet, carFromFields(fleet, fields, 1));
+    }
+    else if (type == "CAR_EDIT")
+    {
+        Car car = carFromFields(fleet, fields, 2);
+        int handle = cars_find(fleet, fields[1]);
+        if (handle == -1)
+            handle = cars_find(fleet, car.plateNumber);
+        if (handle == -1 || !cars_rename(fleet, handle, car.plateNumber))
+            return true;
+        cars_setPrice(fleet, handle, car.pricePerDay);
+        Car *edited = store_get(fleet.cars, handle);
+        edited->brand = car.brand;
+        edited->model = car.model;
+        edited->year = car.year;
+        edited->color = car.color;
+        cars_syncColumns(fleet, handle);
+    }
+    else if (type == "CAR_DELETE")
+    {
+        cars_remove(fleet, fields[1]);
+    }
+    else if (type == "CLIENT_ADD")
+    {
+        Client client = {};
+        client.ID = atoi(fields[1].c_str());
+        client.firstName = fields[2];
+        client.lastName = fields[3];
+        client.password = fields[4];
+        client.email = fields[5];
+        client.phone = fields[6];
+        client.admin = normalizeContact(fields[7]) == "true";
+        clients_add(book, std::move(client));
+    }
+    return true;
 }
 
-void writeCarsRentInfo(Client *clients, int size)
+// Brings the data loaded from the CSV files up to date with the journal.
+// The events of an unfinished compaction come first, then the newer ones.
+void replayJournal(ClientBook &book, Fleet &fleet)
 {
-    ofstream os("rented-cars.csv");
-    os << "ID,plateNumber,startDate,endDate";
-    for (int i = 0; i < size; i++)
+    int rejected = 0;
+    try
     {
-        Client client = clients[i];
-        for (int j = 0; j < client.nbReservation; j++)
-        {
-            Car car = client.cars[j];
-            writeCarRentInfo(os, client.ID, car);
-        }
+        rejected += journal_replay(journal, journal.compactingFileName, [&](const vector<string> &fields)
+                                   { return applyEvent(book, fleet, fields); });
+        rejected += journal_replay(journal, journal.fileName, [&](const vector<string> &fields)
+                                   { return applyEvent(book, fleet, fields); });
     }
-    os.close();
+    catch (exception &e)
+    {
+        // the events after the error are not in memory, so the journal must
+        // outlive this run
+        unloadedFiles |= JOURNAL_FILE;
+        cout << "error: " << e.what() << ", the journal is kept and copied to " << journal.rejectedFileName
+             << "; until it is fixed no data file is rewritten\n";
+    }
+    if (rejected > 0)
+        cout << "error: " << rejected << " journal events could not be applied, they are kept in "
+             << journal.rejectedFileName << "\n";
+}
+
+void rentCar(Fleet &fleet, Client *client);
+
+bool cancelRent(Client *client, Fleet &fleet);
+
+bool deleteCar(Fleet &fleet);
+
+void writeCarRentInfo(RentalsWriter &out, const Fleet &fleet, const Reservation &res)
+{
+    char startDate[20], endDate[20];
+    TimeToString(startDate, 20, res.startDate);
+    TimeToString(endDate, 20, res.endDate);
+    out.write_row(res.clientID, fleet.cars.items[res.car].plateNumber, startDate, endDate);
 }
 
-bool deleteCar(Car *&cars, int &carsCount)
+void writeCarsRentInfo(ofstream &os, ostream &log, const Fleet &fleet)
+{
+    writeCSV(os, log, [&]()
+             {
+                 RentalsWriter out("rented-cars.csv", os);
+                 out.write_header("ID", "plateNumber", "startDate", "endDate");
+                 for (int i = 0; i < store_end(fleet.reservations); i++)
+                     if (store_alive(fleet.reservations, i))
+                         writeCarRentInfo(out, fleet, fleet.reservations.items[i]);
+             });
+}
+
+bool deleteCar(Fleet &fleet)
 {
     string plateNumber;
     cin.ignore();
     cout << "Enter the plate number of the car you want to delete: ";
     getline(cin, plateNumber);
 
-    Car *car = cars_get(cars, carsCount, plateNumber);
+    Car *car = cars_get(fleet, plateNumber);
 
     if (car == NULL)
         cout << "The car is not found in the rented cars.\n";
     else
     {
-        cars_remove(cars, carsCount, plateNumber);
+        // the reservations of the car are dropped with it
+        cars_remove(fleet, plateNumber);
+        journalCarDelete(plateNumber);
         return true;
     }
     return false;
 }
 
-void writeCarToFile(ofstream &os, Car car)
+void writeCarToFile(CarsWriter &out, const Fleet &fleet, const Car &car)
 {
-    os << "\n"
-       << car.plateNumber << "," << car.brand << "," << car.year << ","
-       << car.model << "," << car.pricePerDay << "," << car.color;
+    out.write_row(car.plateNumber, pool_get(fleet.attributes, car.brand), car.year,
+                  pool_get(fleet.attributes, car.model), car.pricePerDay,
+                  pool_get(fleet.attributes, car.color));
 }
 
-void writeCarsToFile(Car *cars, int size)
+void writeCarsToFile(ofstream &os, ostream &log, const Fleet &fleet)
 {
-    ofstream os("cars.csv", ios::out);
-    os << "plateNum,Brand,Year,Model,price_Day,Color";
-    for (int i = 0; i < size; i++)
-        writeCarToFile(os, cars[i]);
-    os.close();
+    writeCSV(os, log, [&]()
+             {
+                 CarsWriter out("cars.csv", os);
+                 out.write_header("plateNum", "Brand", "Year", "Model", "price_Day", "Color");
+                 for (int i = 0; i < store_end(fleet.cars); i++)
+                     if (store_alive(fleet.cars, i))
+                         writeCarToFile(out, fleet, fleet.cars.items[i]);
+             });
 }
 
-void addCarToFile(Car car)
+// Records of the binary image, see image.h. Cars are numbered by their
+// position in the image, which becomes their handle when it is loaded.
+enum ImageSections
 {
-    ofstream os("cars.csv", ios::app);
-    writeCarToFile(os, car);
-    os.close();
+    IMAGE_CARS,
+    IMAGE_PRICE_ORDER, // car numbers sorted by price per day
+    IMAGE_CLIENTS,
+    IMAGE_ID_TABLE, // client ID -> client number, -1 for unused IDs
+    IMAGE_RESERVATIONS, // sorted by car, then start date
+    IMAGE_ATTRIBUTES
+};
+
+struct ImageCar
+{
+    ImageString plateNumber;
+    int32_t brand;
+    int32_t model;
+    int32_t year;
+    int32_t color;
+    double pricePerDay;
+};
+
+struct ImageClient
+{
+    int32_t ID;
+    int32_t admin;
+    ImageString firstName;
+    ImageString lastName;
+    ImageString password;
+    ImageString phone;
+    ImageString email;
+};
+
+struct ImageReservation
+{
+    int32_t car;
+    int32_t clientID;
+    int64_t startDate;
+    int64_t endDate;
+};
+
+const char *imageFile = "carrental.img";
+const char *csvFiles[3] = {"cars.csv", "clients.csv", "rented-cars.csv"};
+
+// Builds the image of the data, which must be what the CSV files with the
+// given stamps hold; the image is only used while they stay unchanged.
+string buildImage(const Store<Client> &clients, const Fleet &fleet, const ImageFileStamp sources[3])
+{
+    ImageBuilder builder;
+    image_begin(builder);
+    for (int i = 0; i < 3; i++)
+        builder.header.sources[i] = sources[i];
+
+    vector<int> carNumber(store_end(fleet.cars), -1);
+    vector<ImageCar> cars;
+    cars.reserve(fleet.cars.count);
+    for (int i = 0; i < store_end(fleet.cars); i++)
+    {
+        const Car *car = store_get(fleet.cars, i);
+        if (car == NULL)
+            continue;
+        ImageCar record = {image_addString(builder, car->plateNumber), car->brand,
+                           car->model, car->year, car->color, car->pricePerDay};
+        carNumber[i] = cars.size();
+        cars.push_back(record);
+    }
+
+    vector<uint32_t> priceOrder(cars.size());
+    for (int i = 0; i < (int)priceOrder.size(); i++)
+        priceOrder[i] = i;
+    sort(priceOrder.begin(), priceOrder.end(), [&](uint32_t a, uint32_t b)
+         { return make_pair(cars[a].pricePerDay, a) < make_pair(cars[b].pricePerDay, b); });
+
+    vector<ImageClient> clientRecords;
+    vector<int32_t> idTable;
+    clientRecords.reserve(clients.count);
+    for (int i = 0; i < store_end(clients); i++)
+    {
+        const Client *client = store_get(clients, i);
+        if (client == NULL)
+            continue;
+        ImageClient record = {client->ID, client->admin,
+                              image_addString(builder, client->firstName),
+                              image_addString(builder, client->lastName),
+                              image_addString(builder, client->password),
+                              image_addString(builder, client->phone),
+                              image_addString(builder, client->email)};
+        if (client->ID >= (int)idTable.size())
+            idTable.resize(client->ID + 1, -1);
+        idTable[client->ID] = clientRecords.size();
+        clientRecords.push_back(record);
+    }
+
+    vector<ImageReservation> reservations;
+    reservations.reserve(fleet.reservations.count);
+    for (int i = 0; i < store_end(fleet.reservations); i++)
+    {
+        const Reservation *res = store_get(fleet.reservations, i);
+        if (res == NULL)
+            continue;
+        ImageReservation record = {carNumber[res->car], res->clientID,
+                                   (int64_t)res->startDate, (int64_t)res->endDate};
+        reservations.push_back(record);
+    }
+    sort(reservations.begin(), reservations.end(),
+         [](const ImageReservation &a, const ImageReservation &b)
+         { return make_pair(a.car, a.startDate) < make_pair(b.car, b.startDate); });
+
+    vector<ImageString> attributes;
+    for (int i = 0; i < (int)fleet.attributes.strings.size(); i++)
+        attributes.push_back(image_addString(builder, pool_get(fleet.attributes, i)));
+
+    image_addSection(builder, IMAGE_CARS, cars);
+    image_addSection(builder, IMAGE_PRICE_ORDER, priceOrder);
+    image_addSection(builder, IMAGE_CLIENTS, clientRecords);
+    image_addSection(builder, IMAGE_ID_TABLE, idTable);
+    image_addSection(builder, IMAGE_RESERVATIONS, reservations);
+    image_addSection(builder, IMAGE_ATTRIBUTES, attributes);
+    return image_finish(builder);
+}
+
+// Loads the data from the image instead of the CSV files. Returns false and
+// loads nothing if there is no usable image or, when checkSources is set,
+// if the CSV files changed since the image was written.
+bool loadImage(ClientBook &book, Fleet &fleet, bool checkSources)
+{
+    MappedImage image;
+    if (!image_map(imageFile, image))
+        return false;
+
+    const size_t recordSizes[8] = {sizeof(ImageCar), sizeof(uint32_t), sizeof(ImageClient),
+                                   sizeof(int32_t), sizeof(ImageReservation), sizeof(ImageString),
+                                   1, 1};
+    const ImageHeader *header = image_header(image, recordSizes);
+    bool usable = header != NULL;
+    for (int i = 0; usable && checkSources && i < 3; i++)
+        usable = image_sameStamp(header->sources[i], image_stamp(csvFiles[i]));
+    if (!usable)
+    {
+        image_unmap(image);
+        return false;
+    }
+
+    // The cars refer to the attributes by their position in the image. One
+    // that is out of range, or a repeated attribute that shifts the IDs,
+    // would be read out of the pool later, so the image is not used at all.
+    const ImageString *attributes = image_section<ImageString>(image, header, IMAGE_ATTRIBUTES);
+    int attributeCount = header->sections[IMAGE_ATTRIBUTES].count;
+    StringPool pool;
+    pool.ids.reserve(attributeCount);
+    for (int i = 0; i < attributeCount; i++)
+        pool_intern(pool, image_string(image, header, attributes[i]));
+    const ImageCar *cars = image_section<ImageCar>(image, header, IMAGE_CARS);
+    int carCount = header->sections[IMAGE_CARS].count;
+    usable = (int)pool.strings.size() == attributeCount;
+    for (int i = 0; usable && i < carCount; i++)
+        usable = cars[i].brand >= 0 && cars[i].brand < attributeCount && cars[i].model >= 0 &&
+                 cars[i].model < attributeCount && cars[i].color >= 0 && cars[i].color < attributeCount;
+    if (!usable)
+    {
+        cout << "error: " << imageFile << " refers to car attributes it does not have\n";
+        image_unmap(image);
+        return false;
+    }
+    fleet.attributes = std::move(pool);
+
+    store_reserve(fleet.cars, carCount);
+    fleet.byPlate.reserve(carCount);
+    for (int i = 0; i < carCount; i++)
+    {
+        Car car = {image_string(image, header, cars[i].plateNumber), cars[i].brand,
+                   cars[i].model, cars[i].year, cars[i].color, cars[i].pricePerDay};
+        string plateNumber = car.plateNumber;
+        fleet.byPlate[plateNumber] = store_add(fleet.cars, std::move(car));
+    }
+    fleet.bookings.resize(carCount);
+    for (int i = carCount - 1; i >= 0; i--) // the first call sizes the columns
+        cars_syncColumns(fleet, i);
+
+    // already sorted, so every insertion lands at the end
+    const uint32_t *priceOrder = image_section<uint32_t>(image, header, IMAGE_PRICE_ORDER);
+    int priceOrderCount = header->sections[IMAGE_PRICE_ORDER].count;
+    for (int i = 0; i < priceOrderCount; i++)
+        if (priceOrder[i] < (uint32_t)carCount)
+            fleet.byPrice.insert(fleet.byPrice.end(),
+                                 make_pair(cars[priceOrder[i]].pricePerDay, (int)priceOrder[i]));
+
+    const ImageClient *clients = image_section<ImageClient>(image, header, IMAGE_CLIENTS);
+    int clientCount = header->sections[IMAGE_CLIENTS].count;
+    store_reserve(book.clients, clientCount);
+    for (int i = 0; i < clientCount; i++)
+    {
+        Client client = {};
+        client.ID = clients[i].ID;
+        client.firstName = image_string(image, header, clients[i].firstName);
+        client.lastName = image_string(image, header, clients[i].lastName);
+        client.password = image_string(image, header, clients[i].password);
+        client.phone = image_string(image, header, clients[i].phone);
+        client.email = image_string(image, header, clients[i].email);
+        client.admin = clients[i].admin != 0;
+        book.emails.insert(normalizeContact(client.email));
+        book.phones.insert(normalizeContact(client.phone));
+        store_add(book.clients, std::move(client));
+    }
+
+    const int32_t *idTable = image_section<int32_t>(image, header, IMAGE_ID_TABLE);
+    book.slotById.assign(idTable, idTable + header->sections[IMAGE_ID_TABLE].count);
+    for (int ID = 0; ID < (int)book.slotById.size(); ID++)
+        if (book.slotById[ID] >= clientCount || book.slotById[ID] < -1)
+            book.slotById[ID] = -1;
+
+    const ImageReservation *reservations =
+        image_section<ImageReservation>(image, header, IMAGE_RESERVATIONS);
+    int reservationCount = header->sections[IMAGE_RESERVATIONS].count;
+    store_reserve(fleet.reservations, reservationCount);
+    for (int i = 0; i < reservationCount; i++)
+    {
+        Client *client = clients_get(book, reservations[i].clientID);
+        int car = reservations[i].car;
+        if (client == NULL || car < 0 || car >= carCount)
+            continue;
+        Reservation res = {car, client->ID, (time_t)reservations[i].startDate,
+                           (time_t)reservations[i].endDate};
+        Booking booking = {res.startDate, res.endDate, -1};
+        booking.reservation = store_add(fleet.reservations, std::move(res));
+        fleet.bookings[car].push_back(booking); // in start date order already
+        client->reservations.push_back(booking.reservation);
+    }
+
+    image_unmap(image);
+    return true;
+}
+
+// The image holds the cars of cars.csv and records the stamps of the CSV
+// files, so it is rewritten along with any of them, unless cars.dat holds
+// the cars.
+unsigned filesToWrite(unsigned files)
+{
+    if (!carSlots.enabled && (files & (CARS_FILE | CLIENTS_FILE | RENTED_CARS_FILE)))
+        files |= IMAGE_FILE;
+    return files;
 }
 
-bool cancelRent(Client *client, Car *cars, int size)
+// Writes the given files, a set of DataFiles, and commits them together
+// (see stage_file); renaming keeps a file's stamp, so the staged files can
+// be stamped before they replace the old ones. It only reads its arguments
+// and sends errors to log, so it can run on the compactor's thread.
+bool writeDataFiles(const Store<Client> &clients, const Fleet &fleet, unsigned files, ostream &log)
+{
+    bool written = (!(files & CARS_FILE) ||
+                    stage_file(csvFiles[0], [&](ofstream &os)
+                               { writeCarsToFile(os, log, fleet); })) &&
+                   (!(files & CLIENTS_FILE) ||
+                    stage_file(csvFiles[1], [&](ofstream &os)
+                               { writeClientsToFile(os, log, clients); })) &&
+                   (!(files & RENTED_CARS_FILE) ||
+                    stage_file(csvFiles[2], [&](ofstream &os)
+                               { writeCarsRentInfo(os, log, fleet); }));
+    vector<string> staged;
+    for (int i = 0; i < 3; i++)
+        if (files & (1 << i))
+            staged.push_back(csvFiles[i]);
+    if (!written)
+    {
+        discard_staged(staged);
+        log << "error: could not write the CSV files, the journal is kept\n";
+        return false;
+    }
+
+    if (files & IMAGE_FILE)
+    {
+        ImageFileStamp sources[3];
+        for (int i = 0; i < 3; i++)
+            sources[i] = image_stamp(files & (1 << i) ? staged_name(csvFiles[i]).c_str() : csvFiles[i]);
+        string image = buildImage(clients, fleet, sources);
+
+        // a missing or stale image only makes the next start slower
+        if (stage_file(imageFile, [&](ofstream &os)
+                       { os.write(image.data(), image.size()); }))
+            staged.push_back(imageFile);
+        else
+            log << "error: could not write " << imageFile << "\n";
+    }
+
+    if (!commit_files(staged))
+    {
+        log << "error: could not replace the data files, the journal is kept\n";
+        return false;
+    }
+    return true;
+}
+
+// writes the files on this thread, refusing while some could not be loaded
+bool saveDataFiles(const Store<Client> &clients, const Fleet &fleet, unsigned files)
+{
+    if (files != 0 && unloadedFiles != 0)
+    {
+        cout << "error: the data files are not rewritten while some could not be loaded, "
+                "the journal is kept\n";
+        return false;
+    }
+    return writeDataFiles(clients, fleet, filesToWrite(files), cout);
+}
+
+Compactor compactor;
+
+// Everything a compaction needs, copied on the main thread, and what it
+// leaves for the main thread to report. The compactor's thread touches
+// nothing else.
+struct Snapshot
+{
+    Store<Client> clients;
+    Fleet fleet;       // only cars, reservations and attributes are filled
+    unsigned files;    // the DataFiles to write
+    bool slotsSynced;  // cars.dat, if used, was synced when the copy was taken
+    string compactingFileName;
+
+    bool written;      // set by the compaction
+    ostringstream log; // its errors
+};
+
+// the running compaction, or the last one until it is reported
+unique_ptr<Snapshot> compaction;
+
+// Once the compactor's thread is joined: prints its errors, and marks the
+// files it could not write so the next checkpoint writes them.
+void finishCompaction()
+{
+    if (compaction == nullptr)
+        return;
+    cout << compaction->log.str();
+    if (!compaction->written)
+        dirtyFiles |= compaction->files;
+    compaction.reset();
+}
+
+// Folds the journal back into the CSV files once it is big or old enough.
+// The data is copied here, between two user actions, so the copy is
+// consistent; the files are written from it on the compactor's thread.
+void maybeCompact(const ClientBook &book, const Fleet &fleet)
+{
+    if (unloadedFiles != 0 || compactor_busy(compactor))
+        return;
+    finishCompaction();
+    if (!compactor_due(compactor, journal.size, journal.startTime) || !journal_rotate(journal))
+        return;
+
+    Snapshot *snapshot = new Snapshot;
+    snapshot->clients = book.clients;
+    snapshot->fleet.cars = fleet.cars;
+    snapshot->fleet.reservations = fleet.reservations;
+    snapshot->fleet.attributes = fleet.attributes;
+    snapshot->files = filesToWrite(dirtyFiles.exchange(0));
+    // the rotated events are already in cars.dat, this makes them durable
+    snapshot->slotsSynced = !carSlots.enabled || slots_sync(carSlots.file);
+    snapshot->compactingFileName = journal.compactingFileName;
+    snapshot->written = false;
+    compaction.reset(snapshot);
+
+    compactor_start(compactor, [snapshot]()
+                    {
+                        snapshot->written = writeDataFiles(snapshot->clients, snapshot->fleet,
+                                                           snapshot->files, snapshot->log) &&
+                                            snapshot->slotsSynced;
+                        if (snapshot->written)
+                            remove(snapshot->compactingFileName.c_str());
+                    });
+}
+
+// rewrites the changed files from memory, after which no journal is needed
+void checkpoint(const ClientBook &book, const Fleet &fleet)
+{
+    compactor_wait(compactor);
+    finishCompaction();
+    unsigned files = dirtyFiles.exchange(0);
+    if (unloadedFiles == 0 && saveDataFiles(book.clients, fleet, files) &&
+        (!carSlots.enabled || slots_sync(carSlots.file)))
+    {
+        journal_dropCompacted(journal);
+        journal_clear(journal);
+    }
+    else
+    {
+        dirtyFiles |= files;
+        journal_close(journal); // the events are needed at the next start
+    }
+}
+
+bool cancelRent(Client *client, Fleet &fleet)
 {
     string plateNumber;
     cin.ignore();
     cout << "Enter the car plate number: ";
     getline(cin, plateNumber);
 
-    Car *car = cars_get(client->cars, client->nbReservation, plateNumber);
+    int reservation = chooseReservation(fleet, client, plateNumber);
 
-    if (car == NULL)
+    if (reservation == -1)
         cout << "The car is not found in the rented cars.\n";
     else
     {
-        Car *c = cars_get(cars, size, plateNumber);
-        c->startDate = -1;
-        c->endDate = -1;
-        cars_remove(client->cars, client->nbReservation, plateNumber);
+        journalCancel(fleet, fleet.reservations.items[reservation]);
+        rentals_remove(fleet, reservation);
         return true;
     }
 
     return false;
 }
 
-void rentCar(Car *cars, int carsCount, Client *client)
+void rentCar(Fleet &fleet, Client *client)
 {
     string plateNumber;
     cin.ignore();
     cout << "Enter the car plate number: ";
     getline(cin, plateNumber);
 
-    Car *car = cars_get(cars, carsCount, plateNumber);
+    int car = cars_find(fleet, plateNumber);
 
-    if (car == NULL)
+    if (car == -1)
     {
         cout << "A car with such plate number does not exist.\n";
         return;
     }
 
-    if (car->startDate != -1)
-        cout << "The car is already rented, choose another one.\n";
+    cout << "set the car rental date:\n";
+    Reservation res = {};
+    res.car = car;
+    res.clientID = client->ID;
+    inputRentalDates(fleet, car, -1, res.startDate, res.endDate);
+
+    journalRent(fleet, res);
+    rentals_add(fleet, client, std::move(res));
+}
+
+double millisecondsSince(chrono::steady_clock::time_point start)
+{
+    return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+}
+
+// Cars and clients do not refer to each other, so their files are loaded at
+// the same time; the reservations need both. The cars come from cars.dat
+// whenever it exists. The files that fail to load are added to
+// unloadedFiles.
+void loadCSVFiles(ClientBook &book, Fleet &fleet)
+{
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    bool fromSlots = slots_exist(carsSlotFile);
+    bool carsLoaded = true;
+    thread carsLoader([&fleet, &carsLoaded, fromSlots]()
+                      {
+                          carsLoaded = fromSlots ? loadCarSlots(fleet) : loadCarsCSV(fleet);
+                      });
+    if (!loadClientsCSV(book))
+        unloadedFiles |= CLIENTS_FILE;
+    carsLoader.join();
+    if (!carsLoaded)
+        unloadedFiles |= CARS_FILE;
+    double carsAndClients = millisecondsSince(start);
+
+    chrono::steady_clock::time_point rentedStart = chrono::steady_clock::now();
+    if (!loadRentedCarsCSV(book, fleet))
+        unloadedFiles |= RENTED_CARS_FILE;
+    cout << "loaded cars and clients in " << carsAndClients << " ms, rented cars in "
+         << millisecondsSince(rentedStart) << " ms\n";
+
+    for (int i = 0; i < 3; i++)
+        if (unloadedFiles & (1 << i))
+            cout << "error: " << (i == 0 && fromSlots ? carsSlotFile : csvFiles[i])
+                 << " was only partly loaded; until it is fixed no data "
+                 << "file is rewritten and the journal is kept\n";
+}
+
+// The image is preferred while it matches the CSV files. It holds the cars
+// of cars.csv, so it is left out while cars.dat is used instead.
+void loadData(ClientBook &book, Fleet &fleet)
+{
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    if (!slots_exist(carsSlotFile) && loadImage(book, fleet, true))
+        cout << "loaded " << imageFile << " in " << millisecondsSince(start) << " ms\n";
     else
     {
-        cout << "set the car rental date:\n";
-        modifyDate(car);
+        loadCSVFiles(book, fleet);
+        if (!carSlots.enabled && unloadedFiles == 0)
+            dirtyFiles |= IMAGE_FILE;
+    }
 
-        addRentCar(client->ID, *car);
-        cars_add(client->cars, client->nbReservation, *car);
+    chrono::steady_clock::time_point journalStart = chrono::steady_clock::now();
+    replayJournal(book, fleet);
+    cout << "replayed the journal in " << millisecondsSince(journalStart) << " ms\n";
+}
+
+// --flush=immediate, --flush=<N>ms, --flush=<N>records or --fsync
+bool parseJournalOption(const string &option, JournalPolicy &policy)
+{
+    if (option == "--fsync")
+    {
+        policy.sync = true;
+        return true;
     }
+    if (option.compare(0, 8, "--flush=") != 0)
+        return false;
+
+    string value = option.substr(8);
+    if (value == "immediate")
+    {
+        policy.flush = FLUSH_IMMEDIATE;
+        return true;
+    }
+    int every = 0;
+    char unit[16] = "";
+    if (sscanf(value.c_str(), "%d%15s", &every, unit) != 2 || every <= 0)
+        return false;
+    if (string(unit) == "ms")
+        policy.flush = FLUSH_EVERY_MS;
+    else if (string(unit) == "records")
+        policy.flush = FLUSH_EVERY_RECORDS;
+    else
+        return false;
+    policy.every = every;
+    return true;
 }
 
-void writePDF(Client *clients, int size);
+// keeps the compiler from dropping the timed loops
+volatile long benchSink;
 
-void freeArrays(Car *&cars, int &carsCount, Client *&clients, int &clientsCount)
+// a fleet of `size` generated cars, for the benchmarks
+void benchFleet(Fleet &fleet, int size)
 {
-    if (carsCount != 0)
-        delete[] cars;
+    store_reserve(fleet.cars, size);
+    for (int i = 0; i < size; i++)
+    {
+        Car car = {};
+        car.plateNumber = "BN" + to_string(i);
+        car.brand = car.model = car.color = -1;
+        car.year = 1995 + i % 30;
+        car.pricePerDay = 20 + (int)((i * 7919LL) % 480);
+        cars_add(fleet, std::move(car));
+    }
+}
 
-    for (int i = 0; i < clientsCount; i++)
-        if (clients[i].nbReservation > 0)
-            delete[] clients[i].cars;
+// --bench: plate lookups through the index against the linear scan they
+// replaced, at several fleet sizes
+void benchLookups()
+{
+    int sizes[3] = {1000, 100000, 1000000};
+    for (int s = 0; s < 3; s++)
+    {
+        Fleet fleet;
+        benchFleet(fleet, sizes[s]);
+
+        // the same spread of plates for both, every one of them present
+        vector<string> plates;
+        for (int i = 0; i < 1000; i++)
+            plates.push_back("BN" + to_string((i * 104729LL) % sizes[s]));
+
+        long found = 0;
+        int indexRounds = 100;
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        for (int r = 0; r < indexRounds; r++)
+            for (int i = 0; i < (int)plates.size(); i++)
+                found += cars_find(fleet, plates[i]);
+        double indexNs = millisecondsSince(start) * 1e6 / (indexRounds * plates.size());
+
+        int scanCount = sizes[s] >= 1000000 ? 100 : plates.size();
+        start = chrono::steady_clock::now();
+        for (int i = 0; i < scanCount; i++)
+            for (int handle = 0; handle < store_end(fleet.cars); handle++)
+                if (fleet.cars.items[handle].plateNumber == plates[i])
+                {
+                    found += handle;
+                    break;
+                }
+        double scanNs = millisecondsSince(start) * 1e6 / scanCount;
 
-    if (clientsCount != 0)
-        delete[] clients;
+        cout << sizes[s] << " cars: index " << indexNs << " ns/lookup, scan "
+             << scanNs << " ns/lookup\n";
+        benchSink = found;
+    }
 }
 
-int main()
+// --bench: price and year range filters over the columns against the same
+// filter over the Car records
+void benchFilters()
 {
-    Car *cars = NULL;
-    int carsCount = 0;
+    Fleet fleet;
+    benchFleet(fleet, 1000000);
 
-    Client *clients = NULL;
-    int clientsCount = 0;
+    CarFilter filters[3] = {carFilter_all(), carFilter_all(), carFilter_all()};
+    filters[0].minPrice = 100, filters[0].maxPrice = 200;
+    filters[1].minYear = 2010, filters[1].maxYear = 2015;
+    filters[2].minPrice = 50, filters[2].maxPrice = 300, filters[2].minYear = 2000, filters[2].maxYear = 2020;
+    const char *names[3] = {"price", "year", "price and year"};
 
-    loadCarsCSV(cars, carsCount);
-    loadClientsCSV(clients, clientsCount);
-    loadRentedCarsCSV(clients, clientsCount, cars, carsCount);
+    int rounds = 20;
+    for (int f = 0; f < 3; f++)
+    {
+        const CarFilter &filter = filters[f];
+        vector<int> selection;
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        for (int r = 0; r < rounds; r++)
+        {
+            selection.clear();
+            cars_filter(fleet.columns, filter, selection);
+        }
+        double columnsMs = millisecondsSince(start) / rounds;
+
+        start = chrono::steady_clock::now();
+        for (int r = 0; r < rounds; r++)
+        {
+            selection.clear();
+            for (int handle = 0; handle < store_end(fleet.cars); handle++)
+            {
+                const Car *car = store_get(fleet.cars, handle);
+                if (car != NULL && car->pricePerDay >= filter.minPrice && car->pricePerDay <= filter.maxPrice &&
+                    car->year >= filter.minYear && car->year <= filter.maxYear)
+                    selection.push_back(handle);
+            }
+        }
+        double recordsMs = millisecondsSince(start) / rounds;
+
+        cout << "1000000 cars, " << names[f] << " filter (" << selection.size() << " match): columns "
+             << columnsMs << " ms, records " << recordsMs << " ms\n";
+    }
+}
+
+// generated files in the format of cars.csv and clients.csv, for the
+// benchmarks that read files; the caller removes them
+bool benchCarsFile(const char *path, int rows)
+{
+    const char *brands[4] = {"Toyota", "Honda", "Kia", "Peugeot"};
+    const char *models[4] = {"Corolla", "Civic", "Rio", "208"};
+    const char *colors[4] = {"Red", "White", "Black", "Silver"};
+    ofstream os(path, ios::binary);
+    writeCSV(os, cout, [&]()
+             {
+                 CarsWriter out(path, os);
+                 out.write_header("plateNum", "Brand", "Year", "Model", "price_Day", "Color");
+                 for (int i = 0; i < rows; i++)
+                     out.write_row("BN" + to_string(i), brands[i % 4], 1995 + i % 30, models[i % 4],
+                                   20 + (int)((i * 7919LL) % 480), colors[i % 4]);
+             });
+    return (bool)os;
+}
+
+bool benchClientsFile(const char *path, int rows)
+{
+    ofstream os(path, ios::binary);
+    writeCSV(os, cout, [&]()
+             {
+                 ClientsWriter out(path, os);
+                 out.write_header("ID", "fName", "lName", "Pass", "Email", "phoneNb", "admin");
+                 for (int i = 0; i < rows; i++)
+                     out.write_row(i, "First" + to_string(i % 1000), "Last" + to_string(i % 997), "Passw0rd!",
+                                   "client" + to_string(i) + "@mail.com", "+9613" + to_string(100000 + i % 900000),
+                                   "false");
+             });
+    return (bool)os;
+}
+
+typedef const char *(*FindByte)(const char *begin, const char *end, char c);
+typedef const char *(*FindFirstOf)(const char *begin, const char *end, char a, char b);
+
+// splits every whole line of [begin, end) into its columns the way the
+// CSV reader does, returns the number of columns
+long benchSplit(const char *begin, const char *end, FindByte findByte, FindFirstOf findFirstOf)
+{
+    long columns = 0;
+    for (;;)
+    {
+        const char *lineEnd = findByte(begin, end, '\n');
+        if (lineEnd == end)
+            return columns;
+        for (const char *col = begin;; col++)
+        {
+            col = findFirstOf(col, lineEnd, ',', '"');
+            columns++;
+            if (col == lineEnd)
+                break;
+        }
+        begin = lineEnd + 1;
+    }
+}
+
+// --bench: line and column scans of 10M-row car and client files with the
+// scalar loops against the SIMD ones. The files are read in 16 MB blocks
+// and only the scans are timed.
+void benchScans()
+{
+    const char *paths[2] = {"bench-cars.csv", "bench-clients.csv"};
+    int rows = 10000000;
+    if (!benchCarsFile(paths[0], rows) || !benchClientsFile(paths[1], rows))
+    {
+        cout << "error: could not write the benchmark files\n";
+        remove(paths[0]), remove(paths[1]);
+        return;
+    }
+
+    for (int p = 0; p < 2; p++)
+    {
+        ifstream is(paths[p], ios::binary);
+        vector<char> block(1 << 24);
+        int kept = 0;
+        long long bytes = 0, scalarColumns = 0, simdColumns = 0;
+        double scalarMs = 0, simdMs = 0;
+        while (is)
+        {
+            is.read(block.data() + kept, block.size() - kept);
+            int size = kept + (int)is.gcount();
+            const char *begin = block.data(), *end = begin + size;
+            // the scans stop at the last '\n', the rest goes with the next block
+            const char *last = end;
+            while (last != begin && last[-1] != '\n')
+                last--;
+
+            chrono::steady_clock::time_point start = chrono::steady_clock::now();
+            scalarColumns += benchSplit(begin, last, io::detail::find_byte_scalar, io::detail::find_first_of_scalar);
+            scalarMs += millisecondsSince(start);
+            start = chrono::steady_clock::now();
+            simdColumns += benchSplit(begin, last, io::detail::find_byte, io::detail::find_first_of);
+            simdMs += millisecondsSince(start);
+
+            bytes += last - begin;
+            kept = end - last;
+            copy(last, end, block.begin());
+        }
+        is.close();
+        remove(paths[p]);
+
+        cout << rows << " rows, " << paths[p] << " (" << bytes / 1000000 << " MB, " << simdColumns
+             << " columns): scalar " << bytes / scalarMs / 1e6 << " GB/s, SIMD " << bytes / simdMs / 1e6
+             << " GB/s\n";
+        benchSink = scalarColumns == simdColumns;
+    }
+}
+
+// --bench: a cars.csv-format file read by ParallelCSVReader with 1, 2, 4 and
+// 8 threads, against one CSVReader, to see how parsing scales with the cores
+void benchParallelRead()
+{
+    const char *path = "bench-cars.csv";
+    int rows = 4000000;
+    if (!benchCarsFile(path, rows))
+    {
+        cout << "error: could not write " << path << "\n";
+        remove(path);
+        return;
+    }
+
+    try
+    {
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        CarsReader::ChunkReader single(path);
+        single.read_header(io::ignore_extra_column, "plateNum", "Brand", "Year", "Model", "price_Day", "Color");
+        vector<CarRow> singleRows;
+        readCarRows(single, singleRows);
+        cout << rows << " rows, " << thread::hardware_concurrency() << " cores: CSVReader "
+             << millisecondsSince(start) << " ms\n";
+
+        unsigned threads[4] = {1, 2, 4, 8};
+        for (int t = 0; t < 4; t++)
+        {
+            start = chrono::steady_clock::now();
+            long count = 0;
+            CarsReader in(path, threads[t]);
+            in.read_header(io::ignore_extra_column, "plateNum", "Brand", "Year", "Model", "price_Day", "Color");
+            in.read_batches<CarRow>(readCarRows, [&](vector<CarRow> &rows)
+                                    { count += rows.size(); });
+            cout << rows << " rows: ParallelCSVReader, " << threads[t] << " threads "
+                 << millisecondsSince(start) << " ms\n";
+            benchSink = count;
+        }
+    }
+    catch (exception &e)
+    {
+        cout << "error: " << e.what() << "\n";
+    }
+    remove(path);
+}
+
+// --bench: the prices of a generated file parsed with the digit by digit
+// loops the CSV reader used before and with parse_float, side by side. The
+// columns are read from the file first and only the parsing is timed.
+void benchDecimals()
+{
+    const char *path = "bench-prices.csv";
+    int rows = 2000000;
+    ofstream os(path, ios::binary);
+    os << "ID,price,rate,total\n";
+    char line[80];
+    for (int i = 0; i < rows; i++)
+    {
+        snprintf(line, sizeof(line), "%d,%d.%02d,0.%04d,%d.%06d\n", i, 20 + i % 480, i % 100,
+                 (int)((i * 37LL) % 10000), (int)((i * 7919LL) % 1000000), (int)((i * 104729LL) % 1000000));
+        os << line;
+    }
+    os.close();
+    if (!os)
+    {
+        cout << "error: could not write " << path << "\n";
+        remove(path);
+        return;
+    }
+
+    // every column followed by its '\0'
+    vector<char> text;
+    vector<int> starts;
+    try
+    {
+        io::CSVReader<3, CsvTrim, CsvQuote> in(path);
+        in.read_header(io::ignore_extra_column, "price", "rate", "total");
+        char *columns[3];
+        while (in.read_row(columns[0], columns[1], columns[2]))
+            for (int c = 0; c < 3; c++)
+            {
+                starts.push_back(text.size());
+                text.insert(text.end(), columns[c], columns[c] + strlen(columns[c]) + 1);
+            }
+    }
+    catch (exception &e)
+    {
+        cout << "error: " << e.what() << "\n";
+    }
+    remove(path);
+
+    vector<double> loops(starts.size()), parsed(starts.size());
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for (int i = 0; i < (int)starts.size(); i++)
+        io::detail::parse_float_loops(&text[starts[i]], loops[i]);
+    double loopsMs = millisecondsSince(start);
+
+    start = chrono::steady_clock::now();
+    for (int i = 0; i < (int)starts.size(); i++)
+        io::detail::parse_float(&text[starts[i]], parsed[i]);
+    double parsedMs = millisecondsSince(start);
+
+    int differ = 0;
+    for (int i = 0; i < (int)starts.size(); i++)
+        differ += loops[i] != parsed[i];
+    cout << starts.size() << " prices: old loops " << loopsMs << " ms, parse_float " << parsedMs
+         << " ms, " << differ << " read differently\n";
+}
+
+typedef io::CSVReader<6, CsvTrim, CsvQuote> CarsFileReader;
+
+// reads the rows of a cars.csv-format file, returns how many there were
+long benchReadCars(CarsFileReader &in)
+{
+    in.read_header(io::ignore_extra_column, "plateNum", "Brand", "Year", "Model", "price_Day", "Color");
+    Car car = {};
+    string brand, model, color;
+    long count = 0;
+    while (in.read_row(car.plateNumber, brand, car.year, model, car.pricePerDay, color))
+        count++;
+    return count;
+}
+
+// --bench: opening and reading 1 KB, 1 MB and 1 GB cars.csv-format files
+// with the block size LineReader picks, against fixed 1 MB and 4 MB blocks
+void benchOpenRead()
+{
+    const char *path = "bench-open.csv";
+    long long sizes[3] = {1LL << 10, 1LL << 20, 1LL << 30};
+    const char *names[3] = {"1 KB", "1 MB", "1 GB"};
+    int blockLens[3] = {0, 1 << 20, 1 << 22};
+    for (int s = 0; s < 3; s++)
+    {
+        // about 38 bytes a row
+        if (!benchCarsFile(path, (int)(sizes[s] / 38)))
+        {
+            cout << "error: could not write " << path << "\n";
+            remove(path);
+            return;
+        }
+        int rounds = (int)max(1LL, min(10000LL, (1LL << 27) / sizes[s]));
+        double ms[3];
+        long count = 0;
+        try
+        {
+            for (int b = 0; b < 3; b++)
+            {
+                chrono::steady_clock::time_point start = chrono::steady_clock::now();
+                for (int r = 0; r < rounds; r++)
+                {
+                    if (blockLens[b] == 0)
+                    {
+                        CarsFileReader in(path);
+                        count = benchReadCars(in);
+                        continue;
+                    }
+                    FILE *file = fopen(path, "rb");
+                    if (file == NULL)
+                        throw runtime_error(string("could not open ") + path);
+                    CarsFileReader in(path, unique_ptr<io::ByteSourceBase>(new io::detail::OwningStdIOByteSourceBase(file)),
+                                      io::read_block_len{blockLens[b]});
+                    count = benchReadCars(in);
+                }
+                ms[b] = millisecondsSince(start) / rounds;
+            }
+        }
+        catch (exception &e)
+        {
+            cout << "error: " << e.what() << "\n";
+            remove(path);
+            return;
+        }
+        cout << names[s] << " (" << count << " rows): picked block " << ms[0] << " ms, 1 MB blocks "
+             << ms[1] << " ms, 4 MB blocks " << ms[2] << " ms\n";
+    }
+    remove(path);
+}
+
+// --self-test: 500000 random decimals, some of them with an exponent, must
+// read the same through the CSV reader as through strtod
+bool testDecimals()
+{
+    mt19937 rng(22);
+    int count = 500000, differ = 0, loopsDiffer = 0;
+    for (int i = 0; i < count; i++)
+    {
+        string number = rng() % 4 == 0 ? "-" : "";
+        int digits = rng() % 7, decimals = rng() % 13;
+        number += digits == 0 ? '0' : (char)('1' + rng() % 9);
+        for (int d = 1; d < digits; d++)
+            number += (char)('0' + rng() % 10);
+        if (decimals > 0)
+            number += '.';
+        for (int d = 0; d < decimals; d++)
+            number += (char)('0' + rng() % 10);
+        if (rng() % 8 == 0)
+            number += "e" + to_string((int)(rng() % 41) - 20);
+
+        double expected = strtod(number.c_str(), NULL), parsed, loops;
+        io::detail::parse<io::throw_on_overflow>(&number[0], parsed);
+        io::detail::parse_float_loops(number.c_str(), loops);
+        if (parsed != expected && differ++ < 5)
+            cout << "  " << number << ": " << parsed << ", strtod " << expected << "\n";
+        loopsDiffer += loops != expected;
+    }
+    cout << count << " random decimals: " << differ << " read differently from strtod ("
+         << loopsDiffer << " with the old loops)\n";
+    return differ == 0;
+}
+
+// hands out text as fread would, and throws once failAt bytes are read
+struct TestByteSource : io::ByteSourceBase
+{
+    const string &text;
+    size_t position, failAt;
+
+    TestByteSource(const string &text, size_t failAt) : text(text), position(0), failAt(failAt) {}
+
+    int read(char *buffer, int size)
+    {
+        if (position >= failAt)
+            throw runtime_error("read error");
+        size_t count = min((size_t)size, min(text.size(), failAt) - position);
+        memcpy(buffer, text.data() + position, count);
+        position += count;
+        return (int)count;
+    }
+};
+
+// --self-test: lines read through the read-ahead ring in 4 KB blocks, from
+// a stream and from a source that fails half way, must come out whole and
+// in order, followed by the error
+bool testReadAhead()
+{
+    mt19937 rng(23);
+    vector<string> lines;
+    string text;
+    for (int i = 0; i < 20000; i++)
+    {
+        string line(rng() % 16 == 0 ? rng() % 3000 : rng() % 200, 'a');
+        for (int c = 0; c < (int)line.size(); c++)
+            line[c] = 'a' + rng() % 26;
+        lines.push_back(line);
+        text += line + (rng() % 4 == 0 ? "\r\n" : "\n");
+    }
+    io::read_block_len blockLen = {4096};
+
+    bool passed = true;
+    istringstream stream(text);
+    io::LineReader in("stream", stream, blockLen);
+    int count = 0;
+    for (char *line; (line = in.next_line()) != NULL; count++)
+        if (count >= (int)lines.size() || lines[count] != line)
+            break;
+    if (count != (int)lines.size() || in.next_line() != NULL)
+    {
+        cout << "  stream: line " << count + 1 << " of " << lines.size() << " read wrong\n";
+        passed = false;
+    }
+
+    size_t failAt = text.size() / 2 / blockLen.len * blockLen.len;
+    io::LineReader failing("failing", unique_ptr<io::ByteSourceBase>(new TestByteSource(text, failAt)), blockLen);
+    count = 0;
+    int errors = 0;
+    try
+    {
+        for (char *line; (line = failing.next_line()) != NULL; count++)
+            if (count >= (int)lines.size() || lines[count] != line)
+                break;
+    }
+    catch (runtime_error &)
+    {
+        errors++;
+    }
+    // the error stays, the lines before it were all right
+    try
+    {
+        failing.next_line();
+    }
+    catch (runtime_error &)
+    {
+        errors++;
+    }
+    if (errors != 2 || count == 0 || count >= (int)lines.size())
+    {
+        cout << "  failing source: " << count << " lines, then " << errors << " of 2 errors\n";
+        passed = false;
+    }
+
+    // stopped while the ring is still being filled
+    {
+        istringstream early(text);
+        io::LineReader stopped("early", early, blockLen);
+        for (int i = 0; i < 100; i++)
+            stopped.next_line();
+    }
+
+    cout << lines.size() << " lines in " << text.size() / blockLen.len << " blocks through the read-ahead ring: "
+         << (passed ? "read back" : "read wrong") << "\n";
+    return passed;
+}
+
+void writePDF(ClientBook &book, Fleet &fleet);
+
+int main(int argc, char *argv[])
+{
+    Fleet fleet;
+    ClientBook book;
+
+    // converters between the CSV files, the binary image and cars.dat
+    string option = argc > 1 ? argv[1] : "";
+    if (option == "--bench")
+    {
+        benchLookups();
+        benchFilters();
+        benchScans();
+        benchParallelRead();
+        benchDecimals();
+        benchOpenRead();
+        return 0;
+    }
+    if (option == "--self-test")
+    {
+        bool passed = testDecimals();
+        passed = testReadAhead() && passed;
+        cout << (passed ? "passed\n" : "FAILED\n");
+        return passed ? 0 : 1;
+    }
+    if (option == "--to-image")
+    {
+        loadCSVFiles(book, fleet);
+        return saveDataFiles(book.clients, fleet, IMAGE_FILE) ? 0 : 1;
+    }
+    if (option == "--to-csv")
+    {
+        bool fromSlots = slots_exist(carsSlotFile);
+        if (fromSlots)
+            loadCSVFiles(book, fleet);
+        else if (!loadImage(book, fleet, false))
+        {
+            cout << "error: " << imageFile << " is missing or unreadable\n";
+            return 1;
+        }
+        // the cars go back to cars.csv
+        slots_close(carSlots.file);
+        carSlots.enabled = false;
+        if (!saveDataFiles(book.clients, fleet, ALL_FILES))
+            return 1;
+        if (fromSlots)
+            remove(carsSlotFile);
+        return 0;
+    }
+    if (option == "--to-cars-dat")
+    {
+        loadData(book, fleet);
+        if (unloadedFiles != 0)
+            return 1;
+        if (!carSlots.enabled && !createCarSlots(fleet))
+        {
+            cout << "error: could not write " << carsSlotFile << "\n";
+            return 1;
+        }
+        checkpoint(book, fleet);
+        return 0;
+    }
+
+    for (int i = 1; i < argc; i++)
+        if (!parseJournalOption(argv[i], journal.policy))
+        {
+            cout << "usage: " << argv[0] << " [--to-image | --to-csv | --to-cars-dat | --bench | --self-test]\n"
+                 << "       " << argv[0] << " [--flush=immediate|<N>ms|<N>records] [--fsync]\n";
+            return 1;
+        }
+
+    cin.tie(&inputTie);
+    loadData(book, fleet);
+
+    // the last run stopped in the middle of a compaction, finish it now
+    if (journal_compacting(journal))
+        checkpoint(book, fleet);
+
+    compactor.maxJournalSize = 1 << 20;
+    compactor.maxJournalAge = 10 * 60;
+    maybeCompact(book, fleet);
 
     int choice;
 
@@ -827,8 +2853,8 @@ int main()
 
     if (choice == 3)
     {
-        writePDF(clients, clientsCount);
-        freeArrays(cars, carsCount, clients, clientsCount);
+        checkpoint(book, fleet);
+        writePDF(book, fleet);
         return 0;
     }
 
@@ -837,13 +2863,12 @@ int main()
     if (choice == 1)
     {
         cin.ignore();
-        Client c = inputClient(clients, clientsCount);
-        c.ID = client_getNewID(clients, clientsCount);
-        clients_add(clients, clientsCount, c);
-
-        addClientToFile(c);
+        Client c = inputClient(book);
+        c.ID = client_getNewID(book);
+        journalClientAdd(c);
 
         cout << "Your client ID is " << c.ID << ", use it for logging in.\n";
+        clients_add(book, std::move(c));
     }
 
     do
@@ -857,7 +2882,7 @@ int main()
         cin.ignore();
         getline(cin, password);
 
-        client = clients_get(clients, clientsCount, id);
+        client = clients_get(book, id);
         if (client == NULL)
         {
             cout << "invalid credentials, try again.\n";
@@ -884,13 +2909,18 @@ int main()
     bool exit = false;
     do
     {
+        journal_tick(journal);
+        maybeCompact(book, fleet);
+
         cout << "Select an option:\n"
              << EXIT << ". exit\n"
              << LIST_CARS << ". list cars\n"
              << LIST_RENTED_CARS << ". list rented cars\n"
              << RENT_CAR << ". rent a car\n"
              << CANCEL_RENT << ". cancel a car rent\n"
-             << MODIFY_DATE << ". mofify the rental date\n";
+             << MODIFY_DATE << ". mofify the rental date\n"
+             << SEARCH_CARS << ". search the cars free in a period\n"
+             << FILTER_CARS << ". filter the cars by price, year, brand...\n";
 
         if (client->admin)
         {
@@ -910,37 +2940,29 @@ int main()
             case ADD_CAR:
             {
                 cin.ignore();
-                addCar(cars, carsCount);
+                addCar(fleet);
             }
             break;
 
             case DELETE_CAR:
             {
-                if (deleteCar(cars, carsCount))
-                    writeCarsToFile(cars, carsCount);
+                deleteCar(fleet);
             }
             break;
 
             case MODIFY_DATA:
             {
                 string plateNumber;
-                int ID;
                 cout << "Enter the plate number of the car: ";
                 cin.ignore();
                 getline(cin, plateNumber);
-                Car *car = cars_get(cars, carsCount, plateNumber);
-                Car *car1 =
-                    cars_get_client(clients, clientsCount, plateNumber, ID);
-                if (car == NULL)
+                int handle = cars_find(fleet, plateNumber);
+                if (handle == -1)
                 {
                     cout << "The car is not found in the rented cars.\n";
                     continue;
                 }
-                if (modifyCar(car, car1))
-                {
-                    writeCarsRentInfo(clients, clientsCount);
-                    writeCarsToFile(cars, carsCount);
-                }
+                modifyCar(fleet, handle);
             }
             break;
 
@@ -960,20 +2982,19 @@ int main()
             break;
 
         case LIST_CARS:
-            printCars(cars, carsCount);
+            printCars(fleet);
             break;
 
         case LIST_RENTED_CARS:
-            printRentedCars(client->cars, client->nbReservation);
+            printRentedCars(fleet, client);
             break;
 
         case RENT_CAR:
-            rentCar(cars, carsCount, client);
+            rentCar(fleet, client);
             break;
 
         case CANCEL_RENT:
-            if (cancelRent(client, cars, carsCount))
-                writeCarsRentInfo(clients, clientsCount);
+            cancelRent(client, fleet);
             break;
 
         case MODIFY_DATE:
@@ -983,28 +3004,32 @@ int main()
             cout << "Enter the car plate number: ";
             getline(cin, plateNumber);
 
-            Car *car =
-                cars_get(client->cars, client->nbReservation, plateNumber);
+            int reservation = chooseReservation(fleet, client, plateNumber);
 
-            if (car == NULL)
+            if (reservation == -1)
                 cout << "The car is not found in the rented cars.\n";
             else
-            {
-                modifyDate(car);
-                writeCarsRentInfo(clients, clientsCount);
-            }
+                modifyDate(fleet, reservation);
         }
         break;
 
+        case SEARCH_CARS:
+            cin.ignore();
+            searchCars(fleet);
+            break;
+
+        case FILTER_CARS:
+            filterCars(fleet);
+            break;
+
         default:
             cout << "invalid choice!\n";
             break;
         }
     } while (!exit);
 
-    writePDF(clients, clientsCount);
-
-    freeArrays(cars, carsCount, clients, clientsCount);
+    checkpoint(book, fleet);
+    writePDF(book, fleet);
 
     return 0;
 }
@@ -1013,39 +3038,40 @@ struct RentedCar
 {
     Client *client;
     Car *car;
+    Reservation *reservation;
 };
 
-void addRentedCar(RentedCar *&cars, int &size, RentedCar rentedCar)
+void addRentedCar(Store<RentedCar> &cars, RentedCar rentedCar)
 {
-    RentedCar *newRentedCars = new RentedCar[size + 1];
-    for (int i = 0; i < size; i++)
-        newRentedCars[i] = cars[i];
-    newRentedCars[size] = rentedCar;
-
-    if (size != 0)
-        delete[] cars;
-
-    cars = newRentedCars;
-    size += 1;
+    store_add(cars, std::move(rentedCar));
 }
 
-void writePDF(Client *clients, int size)
+void writePDF(ClientBook &book, Fleet &fleet)
 {
-    RentedCar *rentedCars = NULL;
-    int rentedCarsCount = 0;
+    Store<RentedCar> rentedCarsStore;
 
-    for (int i = 0; i < size; i++)
+    for (int ID = 0; ID < (int)book.slotById.size(); ID++)
     {
-        Client *client = &clients[i];
-        for (int j = 0; j < client->nbReservation; j++)
+        Client *client = clients_get(book, ID);
+        if (client == NULL)
+            continue;
+        for (int j = 0; j < (int)client->reservations.size(); j++)
         {
+            Reservation *res = store_get(fleet.reservations, client->reservations[j]);
+            if (res == NULL)
+                continue;
             RentedCar car;
-            car.car = &client->cars[j];
+            car.car = &fleet.cars.items[res->car];
             car.client = client;
-            addRentedCar(rentedCars, rentedCarsCount, car);
+            car.reservation = res;
+            addRentedCar(rentedCarsStore, car);
         }
     }
 
+    // nothing is removed from the report list, so its slots are dense
+    RentedCar *rentedCars = rentedCarsStore.items.data();
+    int rentedCarsCount = rentedCarsStore.count;
+
     for (int i = 0; i < rentedCarsCount; i++)
     {
         for (int j = 0; j < rentedCarsCount; j++)
@@ -1103,11 +3129,13 @@ void writePDF(Client *clients, int size)
 
         char StatDate[20];
         char EndDate[20];
-        TimeToString(StatDate, 20, car->startDate);
-        TimeToString(EndDate, 20, car->endDate);
+        TimeToString(StatDate, 20, rentedCar.reservation->startDate);
+        TimeToString(EndDate, 20, rentedCar.reservation->endDate);
 
-        text << "- brand " << car->brand << ", model " << car->model
-             << ", year " << car->year << ", color " << car->color
+        text << "- brand " << pool_get(fleet.attributes, car->brand)
+             << ", model " << pool_get(fleet.attributes, car->model)
+             << ", year " << car->year
+             << ", color " << pool_get(fleet.attributes, car->color)
              << " rented by " << client->firstName << " " << client->lastName
              << " (user id: " << client->ID << ")"
              << " from " << StatDate << " till " << EndDate << " for " << fixed
@@ -1130,7 +3158,4 @@ void writePDF(Client *clients, int size)
 
     pdf_save(pdf, "rented-cars-report.pdf");
     pdf_destroy(pdf);
-
-    if (rentedCars != NULL)
-        delete[] rentedCars;
 }
\ No newline at end of file
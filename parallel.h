@@ -0,0 +1,31 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+// Splits [0, count) into at most one range per hardware thread, each at
+// least minChunk long, and calls work(begin, end) for every range on its own
+// thread. Inputs too small to split run on the calling thread.
+template <class Work>
+void parallel_for(int count, int minChunk, Work work)
+{
+    int threads = std::max(1, (int)std::thread::hardware_concurrency());
+    int chunks = std::min(threads, (count + minChunk - 1) / minChunk);
+    if (chunks <= 1)
+    {
+        work(0, count);
+        return;
+    }
+
+    int chunk = (count + chunks - 1) / chunks;
+    std::vector<std::thread> workers;
+    for (int begin = chunk; begin < count; begin += chunk)
+        workers.push_back(std::thread(work, begin, std::min(count, begin + chunk)));
+    work(0, chunk);
+    for (int i = 0; i < (int)workers.size(); i++)
+        workers[i].join();
+}
+
+#endif
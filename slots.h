@@ -0,0 +1,175 @@
+#ifndef SLOTS_H
+#define SLOTS_H
+
+#include <cstdio>
+#include <cstring>
+#include <stdint.h>
+#include <vector>
+
+#include <sys/types.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// File of fixed-width slots after a small header. A record is read and
+// updated in place with one positioned read or write of its slot, and the
+// slots of removed records are reused by the next records added. Which
+// slots are in use is up to the records themselves.
+//
+// Needs pread/pwrite; without them every function fails, and callers keep
+// to their other files.
+
+const char SLOTS_MAGIC[8] = {'C', 'R', 'S', 'L', 'O', 'T', 'S', '\0'};
+const uint32_t SLOTS_VERSION = 1;
+
+struct SlotFileHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t slotSize;
+};
+
+struct SlotFile
+{
+    int fd;
+    uint32_t slotSize;
+    int slotCount;
+    std::vector<int> freeSlots;
+};
+
+inline off_t slots_offset(const SlotFile &file, int slot)
+{
+    return sizeof(SlotFileHeader) + (off_t)slot * file.slotSize;
+}
+
+inline bool slots_exist(const char *fileName)
+{
+    std::FILE *file = std::fopen(fileName, "rb");
+    if (file == NULL)
+        return false;
+    std::fclose(file);
+    return true;
+}
+
+inline void slots_close(SlotFile &file)
+{
+#ifndef _WIN32
+    if (file.fd != -1)
+        close(file.fd);
+#endif
+    file.fd = -1;
+    file.slotCount = 0;
+    file.freeSlots.clear();
+}
+
+// creates an empty file, replacing any previous one
+inline bool slots_create(SlotFile &file, const char *fileName, uint32_t slotSize)
+{
+    file.fd = -1;
+    file.slotSize = slotSize;
+    file.slotCount = 0;
+    file.freeSlots.clear();
+#ifndef _WIN32
+    file.fd = open(fileName, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (file.fd == -1)
+        return false;
+    SlotFileHeader header = {};
+    std::memcpy(header.magic, SLOTS_MAGIC, sizeof(SLOTS_MAGIC));
+    header.version = SLOTS_VERSION;
+    header.slotSize = slotSize;
+    if (pwrite(file.fd, &header, sizeof(header), 0) == sizeof(header))
+        return true;
+    slots_close(file);
+#endif
+    return false;
+}
+
+// opens an existing file whose slots have the given size
+inline bool slots_open(SlotFile &file, const char *fileName, uint32_t slotSize)
+{
+    file.fd = -1;
+    file.slotSize = slotSize;
+    file.slotCount = 0;
+    file.freeSlots.clear();
+#ifndef _WIN32
+    file.fd = open(fileName, O_RDWR);
+    if (file.fd == -1)
+        return false;
+    SlotFileHeader header;
+    struct stat info;
+    if (pread(file.fd, &header, sizeof(header), 0) == sizeof(header) &&
+        std::memcmp(header.magic, SLOTS_MAGIC, sizeof(SLOTS_MAGIC)) == 0 &&
+        header.version == SLOTS_VERSION && header.slotSize == slotSize &&
+        fstat(file.fd, &info) == 0)
+    {
+        // a slot cut short by a crash while the file grew is dropped
+        file.slotCount = (info.st_size - sizeof(header)) / slotSize;
+        return true;
+    }
+    slots_close(file);
+#endif
+    return false;
+}
+
+// calls visit(slot, data) for every slot, reading many slots at a time
+template <class Visit>
+bool slots_readAll(const SlotFile &file, Visit visit)
+{
+#ifndef _WIN32
+    const int batch = 1024;
+    std::vector<char> buffer((size_t)batch * file.slotSize);
+    for (int first = 0; first < file.slotCount; first += batch)
+    {
+        int count = file.slotCount - first < batch ? file.slotCount - first : batch;
+        size_t size = (size_t)count * file.slotSize;
+        if (pread(file.fd, buffer.data(), size, slots_offset(file, first)) != (ssize_t)size)
+            return false;
+        for (int i = 0; i < count; i++)
+            visit(first + i, buffer.data() + (size_t)i * file.slotSize);
+    }
+    return true;
+#else
+    return false;
+#endif
+}
+
+inline bool slots_write(const SlotFile &file, int slot, const void *data)
+{
+#ifndef _WIN32
+    return pwrite(file.fd, data, file.slotSize, slots_offset(file, slot)) == (ssize_t)file.slotSize;
+#else
+    return false;
+#endif
+}
+
+// returns a free slot, growing the file if none is left
+inline int slots_allocate(SlotFile &file)
+{
+    if (!file.freeSlots.empty())
+    {
+        int slot = file.freeSlots.back();
+        file.freeSlots.pop_back();
+        return slot;
+    }
+    return file.slotCount++;
+}
+
+// overwrites the slot with `emptySlot` and makes it free again
+inline void slots_release(SlotFile &file, int slot, const void *emptySlot)
+{
+    slots_write(file, slot, emptySlot);
+    file.freeSlots.push_back(slot);
+}
+
+inline bool slots_sync(const SlotFile &file)
+{
+#ifndef _WIN32
+    return fsync(file.fd) == 0;
+#else
+    return false;
+#endif
+}
+
+#endif
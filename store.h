@@ -0,0 +1,70 @@
+#ifndef STORE_H
+#define STORE_H
+
+#include <utility>
+#include <vector>
+
+// Record container with amortized growth. Every record is addressed by a
+// handle (its slot index) that stays valid until the record is removed;
+// removing a record tombstones its slot instead of shifting the others.
+template <class T>
+struct Store
+{
+    std::vector<T> items;
+    std::vector<bool> alive;
+    int count = 0; // number of live records
+};
+
+template <class T>
+void store_reserve(Store<T> &store, int capacity)
+{
+    store.items.reserve(capacity);
+    store.alive.reserve(capacity);
+}
+
+// returns the handle of the new record
+template <class T>
+int store_add(Store<T> &store, T &&item)
+{
+    store.items.push_back(std::move(item));
+    store.alive.push_back(true);
+    store.count++;
+    return (int)store.items.size() - 1;
+}
+
+// one past the highest handle ever given out, used to iterate over the slots
+template <class T>
+int store_end(const Store<T> &store)
+{
+    return (int)store.items.size();
+}
+
+template <class T>
+bool store_alive(const Store<T> &store, int handle)
+{
+    return handle >= 0 && handle < store_end(store) && store.alive[handle];
+}
+
+template <class T>
+T *store_get(Store<T> &store, int handle)
+{
+    return store_alive(store, handle) ? &store.items[handle] : NULL;
+}
+
+template <class T>
+const T *store_get(const Store<T> &store, int handle)
+{
+    return store_alive(store, handle) ? &store.items[handle] : NULL;
+}
+
+template <class T>
+void store_remove(Store<T> &store, int handle)
+{
+    if (!store_alive(store, handle))
+        return;
+    store.items[handle] = T(); // release what the record owns
+    store.alive[handle] = false;
+    store.count--;
+}
+
+#endif